@@ -1,17 +1,62 @@
+#include <algorithm>
 #include "LibCamera.h"
 
 using namespace libcamera;
 
-int LibCamera::initCamera(int width, int height, PixelFormat format,
-                          int buffercount, int rotation) {
+// The manager is started by the first camera opened and stopped when the last one is closed
+static std::shared_ptr<CameraManager> acquireCameraManager(int &ret) {
+  static std::mutex mutex;
+  static std::weak_ptr<CameraManager> shared;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<CameraManager> cm = shared.lock();
+  ret = 0;
+  if (!cm) {
+    cm = std::make_shared<CameraManager>();
+    ret = cm->start();
+    if (ret) {
+      std::cout << "Failed to start camera manager: " << ret << std::endl;
+      return nullptr;
+    }
+    shared = cm;
+  }
+  return cm;
+}
+
+// libcamera enumerates cameras in no particular order; indices refer to them sorted by id
+static std::vector<std::shared_ptr<Camera>> sortedCameras(CameraManager &manager) {
+  std::vector<std::shared_ptr<Camera>> cameras = manager.cameras();
+  std::sort(cameras.begin(), cameras.end(),
+            [](const std::shared_ptr<Camera> &a, const std::shared_ptr<Camera> &b) {
+              return a->id() < b->id();
+            });
+  return cameras;
+}
+
+int LibCamera::getNumCameras() {
   int ret;
-  cm = std::make_unique<CameraManager>();
-  ret = cm->start();
-  if (ret) {
-    std::cout << "Failed to start camera manager: " << ret << std::endl;
+  if (!cm) {
+    cm = acquireCameraManager(ret);
+  }
+  return cm ? (int)cm->cameras().size() : 0;
+}
+
+int LibCamera::initCamera(int width, int height, PixelFormat format,
+                          int buffercount, int rotation, int lores_width,
+                          int lores_height, PixelFormat lores_format) {
+  int ret = 0;
+  if (!cm) {
+    cm = acquireCameraManager(ret);
+  }
+  if (!cm) {
     return ret;
   }
-  std::string cameraId = cm->cameras()[0]->id();
+  const std::vector<std::shared_ptr<Camera>> cameras = sortedCameras(*cm);
+  if (cameraIndex_ >= cameras.size()) {
+    std::cerr << "Camera " << cameraIndex_ << " not found (" << cameras.size()
+              << " attached)" << std::endl;
+    return 1;
+  }
+  std::string cameraId = cameras[cameraIndex_]->id();
   camera_ = cm->get(cameraId);
   if (!camera_) {
     std::cerr << "Camera " << cameraId << " not found" << std::endl;
@@ -24,12 +69,33 @@ int LibCamera::initCamera(int width, int height, PixelFormat format,
   }
   camera_acquired_ = true;
 
+  const bool lores = (lores_width > 0 && lores_height > 0);
   std::unique_ptr<CameraConfiguration> config;
-  config = camera_->generateConfiguration({StreamRole::Viewfinder});
+  if (lores) {
+    // Both streams are scaled from the same sensor readout by the ISP
+    config = camera_->generateConfiguration(
+        {StreamRole::VideoRecording, StreamRole::Viewfinder});
+  } else {
+    config = camera_->generateConfiguration({StreamRole::Viewfinder});
+  }
+  if (!config || config->size() != (lores ? 2u : 1u)) {
+    std::cerr << "Camera " << cameraId << " does not support "
+              << (lores ? 2 : 1) << " stream(s)" << std::endl;
+    return 1;
+  }
   libcamera::Size size(width, height);
-  config->at(0).pixelFormat = format;
-  config->at(0).size = size;
-  if (buffercount) config->at(0).bufferCount = buffercount;
+  config->at(MAIN_STREAM).pixelFormat = format;
+  config->at(MAIN_STREAM).size = size;
+  if (buffercount) config->at(MAIN_STREAM).bufferCount = buffercount;
+  if (lores) {
+    config->at(LORES_STREAM).pixelFormat = lores_format;
+    config->at(LORES_STREAM).size = libcamera::Size(lores_width, lores_height);
+    config->at(LORES_STREAM).bufferCount = config->at(MAIN_STREAM).bufferCount;
+  }
+  // Full range BT.601 for YUV, as assumed by the consumers of the planes
+  for (StreamConfiguration &cfg : *config) {
+    if (cfg.pixelFormat == formats::YUV420) cfg.colorSpace = ColorSpace::Sycc;
+  }
   Transform transform = Transform::Identity;
   bool ok;
   Transform rot = transformFromRotation(rotation, &ok);
@@ -56,6 +122,14 @@ int LibCamera::initCamera(int width, int height, PixelFormat format,
   return 0;
 }
 
+libcamera::Size LibCamera::getSize(int stream) const {
+  return config_->at(streamIndex(stream)).size;
+}
+
+unsigned int LibCamera::getStride(int stream) const {
+  return config_->at(streamIndex(stream)).stride;
+}
+
 int LibCamera::startCamera() {
   int ret;
   ret = camera_->configure(config_.get());
@@ -66,6 +140,9 @@ int LibCamera::startCamera() {
 
   camera_->requestCompleted.connect(this, &LibCamera::requestComplete);
 
+  streams_.clear();
+  for (StreamConfiguration &cfg : *config_) streams_.push_back(cfg.stream());
+
   allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
 
   return startCapture();
@@ -103,15 +180,25 @@ int LibCamera::startCapture() {
         std::cerr << "Can't set buffer for request" << std::endl;
         return ret;
       }
+      // Planes may share a dmabuf at different offsets (e.g. YUV420), so
+      // each dmabuf is mapped once as a whole
+      std::map<int, unsigned int> lengths;
       for (const FrameBuffer::Plane &plane : buffer->planes()) {
-        void *memory =
-            mmap(NULL, plane.length, PROT_READ, MAP_SHARED, plane.fd.get(), 0);
-        mappedBuffers_[plane.fd.get()] = std::make_pair(memory, plane.length);
+        unsigned int &length = lengths[plane.fd.get()];
+        length = std::max(length, plane.offset + plane.length);
+      }
+      for (const auto &fd_length : lengths) {
+        void *memory = mmap(NULL, fd_length.second, PROT_READ, MAP_SHARED,
+                            fd_length.first, 0);
+        mappedBuffers_[fd_length.first] =
+            std::make_pair(memory, fd_length.second);
       }
     }
 
     requests_.push_back(std::move(request));
   }
+  completedRequests_ = std::make_unique<spsc_queue<Request *>>(
+      std::max<size_t>(requests_.size(), 1), queue_policy::block);
 
   ret = camera_->start(&this->controls_);
   // ret = camera_->start();
@@ -148,43 +235,68 @@ void LibCamera::requestComplete(Request *request) {
 }
 
 void LibCamera::processRequest(Request *request) {
-  std::lock_guard<std::mutex> lock(free_requests_mutex_);
-  requestQueue.push(request);
+  // Lock-free hand-over to the consumer; wakes up a blocked readFrame()
+  completedRequests_->push(std::move(request));
+}
+
+void LibCamera::requeueRequest(Request *request) {
+  {
+    // Requests are gone once the camera has been stopped
+    std::lock_guard<std::mutex> stop_lock(camera_stop_mutex_);
+    if (!camera_started_) return;
+    request->reuse(Request::ReuseBuffers);
+  }
+  queueRequest(request);
+}
+
+void LibCamera::mapFrame(Request *request, int stream, uint8_t **planes,
+                         uint32_t *size) {
+  FrameBuffer *buffer = request->findBuffer(streams_[streamIndex(stream)]);
+  std::fill(planes, planes + MAX_PLANES, nullptr);
+  *size = 0;
+  if (!buffer) return;
+  const unsigned int nplanes =
+      std::min<unsigned int>(buffer->planes().size(), MAX_PLANES);
+  for (unsigned int i = 0; i < nplanes; ++i) {
+    const FrameBuffer::Plane &plane = buffer->planes()[i];
+    const FrameMetadata::Plane &meta = buffer->metadata().planes()[i];
+    uint8_t *mem = (uint8_t *)mappedBuffers_[plane.fd.get()].first;
+
+    *size += std::min(meta.bytesused, plane.length);
+    planes[i] = mem + plane.offset;
+  }
 }
 
 void LibCamera::returnFrameBuffer(LibcameraOutData frameData) {
-  uint64_t request = frameData.request;
-  Request *req = (Request *)request;
-  req->reuse(Request::ReuseBuffers);
-  queueRequest(req);
+  Request *req = (Request *)frameData.request;
+  if (req) requeueRequest(req);
 }
 
 bool LibCamera::readFrame(LibcameraOutData *frameData) {
-  std::lock_guard<std::mutex> lock(free_requests_mutex_);
-  if (!requestQueue.empty()) {
-    Request *request = this->requestQueue.front();
-
-    const Request::BufferMap &buffers = request->buffers();
-    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-      FrameBuffer *buffer = it->second;
-      for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
-        const FrameBuffer::Plane &plane = buffer->planes()[i];
-        const FrameMetadata::Plane &meta = buffer->metadata().planes()[i];
-        void *data = mappedBuffers_[plane.fd.get()].first;
-        unsigned int length = std::min(meta.bytesused, plane.length);
-
-        frameData->size = length;
-        frameData->imageData = (uint8_t *)data;
-      }
-    }
-    this->requestQueue.pop();
-    frameData->request = (uint64_t)request;
-    return true;
-  } else {
-    Request *request = nullptr;
+  Request *request = nullptr;
+  if (!completedRequests_ || !completedRequests_->try_pop(request)) {
     frameData->request = (uint64_t)request;
     return false;
   }
+  uint8_t *planes[MAX_PLANES];
+  mapFrame(request, MAIN_STREAM, planes, &frameData->size);
+  frameData->imageData = planes[0];
+  frameData->request = (uint64_t)request;
+  return true;
+}
+
+bool LibCamera::readFrame(LibcameraFrame &frame,
+                          std::chrono::milliseconds timeout) {
+  frame.release();
+  Request *request = nullptr;
+  if (!completedRequests_ || !completedRequests_->pop(request, timeout)) {
+    return false;
+  }
+  frame.cam_ = this;
+  frame.request_ = request;
+  for (int i = 0; i < MAX_STREAMS; ++i)
+    mapFrame(request, i, frame.planes_[i], &frame.size_[i]);
+  return true;
 }
 
 void LibCamera::set(ControlList controls) {
@@ -206,7 +318,10 @@ void LibCamera::stopCamera() {
     }
     camera_->requestCompleted.disconnect(this, &LibCamera::requestComplete);
   }
-  while (!requestQueue.empty()) requestQueue.pop();
+  if (completedRequests_) {
+    // Wakes up a blocked readFrame(); completed but unread frames are dropped
+    completedRequests_->close();
+  }
 
   requests_.clear();
 
@@ -223,3 +338,33 @@ void LibCamera::closeCamera() {
 
   cm.reset();
 }
+
+LibcameraFrame::LibcameraFrame(LibcameraFrame &&other) noexcept
+    : cam_(other.cam_),
+      request_(other.request_) {
+  std::memcpy(planes_, other.planes_, sizeof(planes_));
+  std::memcpy(size_, other.size_, sizeof(size_));
+  other.cam_ = nullptr;
+  other.request_ = nullptr;
+}
+
+LibcameraFrame &LibcameraFrame::operator=(LibcameraFrame &&other) noexcept {
+  if (this != &other) {
+    release();
+    cam_ = other.cam_;
+    request_ = other.request_;
+    std::memcpy(planes_, other.planes_, sizeof(planes_));
+    std::memcpy(size_, other.size_, sizeof(size_));
+    other.cam_ = nullptr;
+    other.request_ = nullptr;
+  }
+  return *this;
+}
+
+void LibcameraFrame::release() {
+  if (request_) cam_->requeueRequest(request_);
+  cam_ = nullptr;
+  request_ = nullptr;
+  std::memset(planes_, 0, sizeof(planes_));
+  std::memset(size_, 0, sizeof(size_));
+}
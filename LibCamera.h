@@ -2,6 +2,7 @@
 
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/color_space.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/formats.h>
@@ -19,6 +20,8 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -29,6 +32,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "spsc_queue.hpp"
+
 // using namespace libcamera;
 
 typedef struct {
@@ -37,14 +42,70 @@ typedef struct {
   uint64_t request;
 } LibcameraOutData;
 
+class LibCamera;
+
+// Streams configured by LibCamera::initCamera()
+constexpr int MAIN_STREAM  = 0;  // full resolution, e.g. for HTJ2K encoding
+constexpr int LORES_STREAM = 1;  // optional low resolution stream, e.g. for detection
+constexpr int MAX_STREAMS  = 2;
+constexpr int MAX_PLANES   = 3;  // Y, U, V of YUV420
+
+// Captured frame owned by the caller. The buffers of all streams of a request are handed back to the
+// camera together when the handle is released or destroyed, so a frame can never be returned twice.
+// Handles shall be released before stopCamera().
+class LibcameraFrame {
+ public:
+  LibcameraFrame() : cam_(nullptr), request_(nullptr), planes_{}, size_{} {};
+  ~LibcameraFrame() { release(); };
+
+  LibcameraFrame(LibcameraFrame &&other) noexcept;
+  LibcameraFrame &operator=(LibcameraFrame &&other) noexcept;
+  LibcameraFrame(const LibcameraFrame &)            = delete;
+  LibcameraFrame &operator=(const LibcameraFrame &) = delete;
+
+  // Without a low resolution stream, LORES_STREAM refers to the main one. Planar formats have
+  // one pointer per plane; the chroma planes of YUV420 have half the stride of the luma plane.
+  uint8_t *data(int stream = MAIN_STREAM, int plane = 0) const { return planes_[stream][plane]; }
+  uint32_t size(int stream = MAIN_STREAM) const { return size_[stream]; }
+  bool valid() const { return request_ != nullptr; }
+
+  // Requeue the buffer now
+  void release();
+
+ private:
+  friend class LibCamera;
+  LibCamera *cam_;
+  libcamera::Request *request_;
+  uint8_t *planes_[MAX_STREAMS][MAX_PLANES];
+  uint32_t size_[MAX_STREAMS];
+};
+
 class LibCamera {
  public:
-  LibCamera(){};
+  // Index of the camera among those enumerated by libcamera, sorted by id here (libcamera itself
+  // promises no order)
+  explicit LibCamera(unsigned int index = 0) : cameraIndex_(index){};
   ~LibCamera(){};
 
-  int initCamera(int width, int height, libcamera::PixelFormat format, int buffercount, int rotation);
+  // Number of cameras attached; the camera manager started to count them is kept for initCamera()
+  int getNumCameras();
+
+  // A low resolution stream is configured in addition to the main one if lores_width and
+  // lores_height are given. Both are filled by the same request and read by a single readFrame().
+  int initCamera(int width, int height, libcamera::PixelFormat format, int buffercount, int rotation,
+                 int lores_width = 0, int lores_height = 0,
+                 libcamera::PixelFormat lores_format = libcamera::formats::RGB888);
+
+  int getNumStreams() const { return config_ ? (int)config_->size() : 0; }
+  // Size and line stride in bytes of a stream, valid after initCamera()
+  libcamera::Size getSize(int stream = MAIN_STREAM) const;
+  unsigned int getStride(int stream = MAIN_STREAM) const;
 
   int startCamera();
+  // Wait up to timeout for a completed frame; must be called from a single consumer thread
+  bool readFrame(LibcameraFrame &frame,
+                 std::chrono::milliseconds timeout = std::chrono::milliseconds(100));
+  // Non-blocking variant handing out the raw request; return it with returnFrameBuffer()
   bool readFrame(LibcameraOutData *frameData);
   void returnFrameBuffer(LibcameraOutData frameData);
 
@@ -55,25 +116,33 @@ class LibCamera {
  private:
   int startCapture();
   int queueRequest(libcamera::Request *request);
+  void requeueRequest(libcamera::Request *request);
+  int streamIndex(int stream) const { return (stream < (int)config_->size()) ? stream : MAIN_STREAM; }
+  void mapFrame(libcamera::Request *request, int stream, uint8_t **planes, uint32_t *size);
   void requestComplete(libcamera::Request *request);
   void processRequest(libcamera::Request *request);
 
   unsigned int cameraIndex_;
   uint64_t last_;
-  std::unique_ptr<libcamera::CameraManager> cm;
+  // libcamera allows a single CameraManager per process; it is shared by all instances
+  std::shared_ptr<libcamera::CameraManager> cm;
   std::shared_ptr<libcamera::Camera> camera_;
   bool camera_acquired_ = false;
   bool camera_started_  = false;
   std::unique_ptr<libcamera::CameraConfiguration> config_;
+  std::vector<libcamera::Stream *> streams_;  // in the order of MAIN_STREAM, LORES_STREAM
   std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
   std::vector<std::unique_ptr<libcamera::Request>> requests_;
   // std::map<std::string, Stream *> stream_;
   std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
 
-  std::queue<libcamera::Request *> requestQueue;
+  // Completed requests, pushed by the libcamera callback thread and popped by readFrame(). Its
+  // capacity equals the number of requests, so the callback never waits.
+  std::unique_ptr<spsc_queue<libcamera::Request *>> completedRequests_;
 
   libcamera::ControlList controls_;
   std::mutex control_mutex_;
   std::mutex camera_stop_mutex_;
-  std::mutex free_requests_mutex_;
-};
\ No newline at end of file
+
+  friend class LibcameraFrame;
+};
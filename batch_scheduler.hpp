@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Snapshot of scheduler counters
+struct batch_stats {
+  uint64_t submitted;  // items accepted from the sources
+  uint64_t replaced;   // items replaced by a newer one of the same source before they were batched
+  uint64_t batches;    // batches handed to the consumer
+  uint64_t items;      // items in those batches
+  uint64_t deadlines;  // batches closed by the deadline rather than full
+};
+
+/**************************************************************************************************
+  Dynamic batching of items from several sources (e.g. frames of several cameras)
+
+  Each source holds at most one pending item; a newer item replaces it, so a source that runs ahead
+  of the consumer never builds up latency. next_batch() waits for the first pending item and then
+  until every source has one or `max_wait` has passed since that first item arrived, and returns
+  all pending items in source order. A full batch goes out at once; a missing or slow camera delays
+  the others by `max_wait` at most.
+**************************************************************************************************/
+template <typename T>
+class batch_scheduler {
+ private:
+  using clock = std::chrono::steady_clock;
+  struct slot {
+    bool pending;
+    T item;
+    clock::time_point arrival;
+  };
+
+  const std::chrono::microseconds max_wait;
+  std::vector<slot> slots;
+  size_t num_pending;
+  bool closed;
+  std::mutex mtx;
+  std::condition_variable cv;
+  batch_stats stats;
+
+ public:
+  batch_scheduler(size_t num_sources, std::chrono::microseconds wait)
+      : max_wait(wait), slots(std::max<size_t>(num_sources, 1)), num_pending(0), closed(false), stats() {
+    for (auto &s : slots) {
+      s.pending = false;
+    }
+  }
+
+  size_t num_sources() const { return slots.size(); }
+
+  // Producer side, one thread per source (or any); never waits for the consumer
+  void submit(size_t source, T &&item) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      slot &s = slots[source];
+      stats.submitted++;
+      if (s.pending) {
+        stats.replaced++;
+      } else {
+        s.pending = true;
+        s.arrival = clock::now();
+        num_pending++;
+      }
+      s.item = std::move(item);
+    }
+    cv.notify_one();
+  }
+
+  // Consumer side: fills `batch` with (source, item) pairs; false once closed and drained
+  bool next_batch(std::vector<std::pair<size_t, T>> &batch) {
+    batch.clear();
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return num_pending > 0 || closed; });
+    if (num_pending == 0) {
+      return false;
+    }
+    clock::time_point first = clock::time_point::max();
+    for (const auto &s : slots) {
+      if (s.pending) {
+        first = std::min(first, s.arrival);
+      }
+    }
+    const bool full =
+        cv.wait_until(lock, first + max_wait, [this] { return num_pending == slots.size() || closed; });
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (slots[i].pending) {
+        batch.emplace_back(i, std::move(slots[i].item));
+        slots[i].pending = false;
+      }
+    }
+    num_pending = 0;
+    stats.batches++;
+    stats.items += batch.size();
+    stats.deadlines += full ? 0 : 1;
+    return true;
+  }
+
+  // Wakes the consumer; pending items are still handed out
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      closed = true;
+    }
+    cv.notify_all();
+  }
+
+  batch_stats get_stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return stats;
+  }
+};
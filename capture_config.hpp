@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include "LibCamera.h"
+
+// Default receiver of HTJ2K codestreams
+constexpr const char *DEFAULT_SINK_ADDRESS = "133.36.41.118";
+constexpr int32_t DEFAULT_SINK_PORT        = 4001;
+
+// Camera controls of the capture applications: 30 fps, auto exposure and auto focus
+inline void setup_camera(LibCamera &cam) {
+  libcamera::ControlList controls_;
+  int64_t frame_time = 1000000 / 30;
+  // Set frame rate
+  controls_.set(libcamera::controls::FrameDurationLimits,
+                libcamera::Span<const int64_t, 2>({frame_time, frame_time}));
+  // Adjust the brightness of the output images, in the range -1.0 to 1.0
+  controls_.set(libcamera::controls::Brightness, 0.0);
+  // Adjust the contrast of the output image, where 1.0 = normal contrast
+  controls_.set(libcamera::controls::Contrast, 1.0);
+  // Set the exposure time
+  //  controls_.set(libcamera::controls::ExposureTime, 20000);
+  // Set Auto exposure
+  controls_.set(libcamera::controls::AeEnable, libcamera::controls::AE_ENABLE);
+  // Focus related settings
+  //   Set autofocus mode
+  controls_.set(libcamera::controls::AfMode, libcamera::controls::AfModeAuto);
+  controls_.set(libcamera::controls::AfMetering, libcamera::controls::AfMeteringAuto);
+  controls_.set(libcamera::controls::AfRange, libcamera::controls::AfRangeNormal);
+  controls_.set(libcamera::controls::AfSpeed, libcamera::controls::AfSpeedNormal);
+  //   Set manual focus mode
+  // controls_.set(libcamera::controls::AfMode, libcamera::controls::AfModeManual);
+  // controls_.set(libcamera::controls::LensPosition, 0.5);
+  cam.set(controls_);  // Write camera settings
+}
+
+// Receiver of codestreams, overridden by HTJ2K_SINK=address:port
+inline void get_sink(std::string &address, int32_t &port) {
+  address         = DEFAULT_SINK_ADDRESS;
+  port            = DEFAULT_SINK_PORT;
+  const char *env = std::getenv("HTJ2K_SINK");
+  if (env == nullptr) {
+    return;
+  }
+  const std::string s(env);
+  const size_t colon = s.rfind(':');
+  if (colon == std::string::npos) {
+    address = s;
+  } else {
+    address = s.substr(0, colon);
+    port    = std::stoi(s.substr(colon + 1));
+  }
+}
+
+// Capture time [us since the Unix epoch]
+inline uint64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
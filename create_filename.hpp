@@ -3,7 +3,7 @@
 #include <ctime>
 #include <string>
 
-std::string create_filename_based_on_time() {
+inline std::string create_filename_based_on_time() {
   char tbuf[32];
   const auto now          = std::chrono::system_clock::now();
   std::time_t now_c = std::chrono::system_clock::to_time_t(now);
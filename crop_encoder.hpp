@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/imgproc.hpp>
+#include "htj2k_encoder.hpp"
+#include "htj2k_ycbcr_encoder.hpp"
+#include "yolo.hpp"
+
+// Codestream of one detected object
+struct encoded_crop {
+  int32_t class_id;
+  float score;
+  cv::Rect box;                     // detection in frame coordinates
+  cv::Rect crop;                    // encoded region in frame coordinates: box + padding, even-aligned
+  int32_t levels;                   // DWT levels used for this crop
+  std::vector<uint8_t> codestream;  // empty if encoding failed
+  double t_encode;                  // [ms]
+};
+
+/**************************************************************************************************
+  Parallel HTJ2K encoding of detection crops
+
+  Each detection box, grown by the padding and clipped to the frame, is encoded as its own
+  codestream. Crops are spread over a pool of worker threads, each with its own encoders, and
+  encode() returns when all crops of the frame are done. The number of DWT levels follows the
+  crop size, so that small crops are not decomposed into empty subbands.
+  Crops are coded straight from the frame: BGR through strided views (see htj2k_encoder.hpp), I420
+  from the planes as YCbCr 4:2:0 (crop origins and sizes are even).
+**************************************************************************************************/
+class crop_encoder {
+ private:
+  struct worker_state {
+    htj2k_encoder rgb;
+    htj2k_ycbcr_encoder ycbcr;
+  };
+
+  const int32_t padding;
+  const int32_t quality;
+  const int32_t max_levels;
+  std::vector<std::unique_ptr<worker_state>> states;
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::condition_variable cv_jobs;
+  std::condition_variable cv_done;
+  // Current frame
+  cv::Mat frame;
+  pixel_format format;
+  std::vector<encoded_crop> crops;
+  size_t next;
+  size_t remaining;
+  bool running;
+  double t_frame;
+
+ public:
+  crop_encoder(int32_t num_workers, int32_t padding_px, int32_t qfactor, int32_t levels = 5)
+      : padding(padding_px),
+        quality(qfactor),
+        max_levels(levels),
+        format(pixel_format::bgr),
+        next(0),
+        remaining(0),
+        running(true),
+        t_frame(0.0) {
+    for (int32_t i = 0; i < std::max(num_workers, 1); ++i) {
+      states.emplace_back(new worker_state);
+      worker_state &st = *states.back();
+      st.rgb.set_block_size(64);
+      st.rgb.set_progression_order("RPCL");
+      st.ycbcr.set_block_size(64);
+      st.ycbcr.set_progression_order("RPCL");
+      st.ycbcr.set_qfactor(quality);
+    }
+    for (auto &st : states) {
+      worker_state *p = st.get();
+      workers.emplace_back([this, p] { worker(*p); });
+    }
+  }
+
+  ~crop_encoder() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      running = false;
+    }
+    cv_jobs.notify_all();
+    for (auto &th : workers) {
+      th.join();
+    }
+  }
+
+  crop_encoder(const crop_encoder &)            = delete;
+  crop_encoder &operator=(const crop_encoder &) = delete;
+
+  // Encode the crops of all detections; the frame is only read. The result is valid until the next
+  // call, and its codestreams may be moved out.
+  std::vector<encoded_crop> &encode(const cv::Mat &image, pixel_format fmt,
+                                    const std::vector<detection> &dets) {
+    const auto t0   = std::chrono::high_resolution_clock::now();
+    const bool i420 = (fmt == pixel_format::i420);
+    const cv::Rect bounds(0, 0, image.cols, i420 ? image.rows * 2 / 3 : image.rows);
+    std::unique_lock<std::mutex> lock(mtx);
+    frame  = image;
+    format = fmt;
+    crops.clear();
+    for (const auto &d : dets) {
+      const cv::Rect p = cv::Rect(d.box.x - padding, d.box.y - padding, d.box.width + 2 * padding,
+                                  d.box.height + 2 * padding)
+                         & bounds;
+      // Even start (4:2:0 chroma sites) and end, rounded outwards so that no edge of the box is lost
+      const int32_t x0 = p.x & ~1, y0 = p.y & ~1;
+      const int32_t x1 = (p.x + p.width + 1) & ~1, y1 = (p.y + p.height + 1) & ~1;
+      const cv::Rect r = cv::Rect(x0, y0, x1 - x0, y1 - y0) & bounds;
+      if (r.width >= 8 && r.height >= 8) {
+        crops.push_back({d.class_id, d.score, d.box, r, 0, {}, 0.0});
+      }
+    }
+    next      = 0;
+    remaining = crops.size();
+    cv_jobs.notify_all();
+    cv_done.wait(lock, [this] { return remaining == 0; });
+    frame.release();
+    t_frame = elapsed_ms(t0);
+    return crops;
+  }
+
+  // Wall-clock time of the last encode() [ms]
+  double get_encode_time() const { return t_frame; }
+
+  size_t num_workers() const { return workers.size(); }
+
+ private:
+  static double elapsed_ms(std::chrono::high_resolution_clock::time_point t0) {
+    using namespace std::chrono;
+    return duration<double, std::milli>(high_resolution_clock::now() - t0).count();
+  }
+
+  void worker(worker_state &st) {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+      cv_jobs.wait(lock, [this] { return next < crops.size() || !running; });
+      if (!running) {
+        return;
+      }
+      encoded_crop &c = crops[next++];
+      lock.unlock();
+      encode_crop(st, c);
+      lock.lock();
+      if (--remaining == 0) {
+        cv_done.notify_one();
+      }
+    }
+  }
+
+  void encode_crop(worker_state &st, encoded_crop &c) {
+    const auto t0 = std::chrono::high_resolution_clock::now();
+    // Lowest resolution of at least 8 pixels
+    int32_t levels = 0;
+    while (levels < max_levels && (std::min(c.crop.width, c.crop.height) >> (levels + 1)) >= 8) {
+      ++levels;
+    }
+    c.levels = levels;
+    try {
+      if (format == pixel_format::i420) {
+        const int32_t w = frame.cols, h = frame.rows * 2 / 3;
+        const uint8_t *y = frame.data + c.crop.y * w + c.crop.x;
+        const uint8_t *u = frame.data + w * h + (c.crop.y / 2) * (w / 2) + c.crop.x / 2;
+        const uint8_t *v = u + (w / 2) * (h / 2);
+        st.ycbcr.set_decompositions(levels);
+        c.codestream = st.ycbcr.encode(y, u, v, c.crop.width, c.crop.height, w, w / 2);
+      } else {
+        const cv::Mat roi    = frame(c.crop);
+        const image_view src = {roi.data, roi.cols, roi.rows, static_cast<int32_t>(roi.step[0]), 3, true};
+        st.rgb.set_decompositions(levels);
+        const codestream_span cs = st.rgb.encode(src, quality);
+        c.codestream.assign(cs.begin(), cs.end());
+      }
+    } catch (...) {
+      c.codestream.clear();  // reported by the encoder
+    }
+    c.t_encode = elapsed_ms(t0);
+  }
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include "htj2k_encoder.hpp"
+#include "htj2k_ycbcr_encoder.hpp"
+#include "roi_filter.hpp"
+#include "yolo.hpp"
+
+// What the pool did with a frame
+enum class encode_outcome {
+  encoded,     // at the full Qfactor
+  downgraded,  // at the reduced Qfactor, because the pool was busy
+  skipped,     // not encoded, because too many frames were in flight
+  failed       // the encoder reported an error
+};
+
+// Admission of frames, by the number of frames in flight (queued or being encoded) at submission
+struct encode_policy {
+  int32_t qfactor;            // normal quality
+  int32_t downgrade_qfactor;  // quality when the pool is busy
+  size_t downgrade_depth;     // frames in flight from which the reduced Qfactor is used
+  size_t max_in_flight;       // frames in flight from which new frames are skipped
+};
+
+struct encode_result {
+  uint64_t seq;  // submission number
+  encode_outcome outcome;
+  int32_t qfactor;                  // Qfactor used
+  std::vector<uint8_t> codestream;  // empty unless encoded or downgraded
+  double t_encode;                  // [ms]
+};
+
+struct encode_pool_stats {
+  size_t in_flight;
+  uint64_t submitted;
+  uint64_t encoded;
+  uint64_t downgraded;
+  uint64_t skipped;
+  uint64_t failed;
+};
+
+/**************************************************************************************************
+  Parallel HTJ2K encoding of whole frames on a pool of worker threads
+
+  Bursts of triggered frames are fanned out to N workers, each with its own encoders (RGB and
+  YCbCr 4:2:0) and ROI filter. Results are delivered by futures; waiting on them in submission
+  order restores the capture order for transmission, as for yolo_async. submit() never blocks:
+  when the pool falls behind, frames are first encoded at a lower Qfactor (cheaper to code and to
+  send) and then skipped, according to the policy, so memory and latency stay bounded.
+  The submitted cv::Mat is referenced, not copied; pass a clone of camera buffers. Each result owns
+  its codestream, copied out of the worker's encoder buffer, which the worker's next frame reuses;
+  that copy is one allocation per encoded frame.
+**************************************************************************************************/
+class encoder_pool {
+ private:
+  struct worker_state {
+    htj2k_encoder rgb;
+    htj2k_ycbcr_encoder ycbcr;
+    roi_filter roi;
+    explicit worker_state(int32_t roi_factor) : roi(roi_factor) {}
+  };
+
+  struct job {
+    uint64_t seq;
+    cv::Mat frame;
+    pixel_format format;
+    std::vector<detection> detections;
+    int32_t qfactor;
+    bool downgraded;  // admitted while the pool was behind, whatever the Qfactor
+    std::promise<encode_result> promise;
+  };
+
+  const encode_policy policy;
+  const bool use_roi;
+  std::vector<std::unique_ptr<worker_state>> states;
+  std::vector<std::thread> workers;
+  std::deque<job> jobs;
+  std::mutex mtx;
+  std::condition_variable cv_jobs;
+  size_t in_flight;
+  bool running;
+  encode_pool_stats stats;
+
+ public:
+  // roi_factor > 1 low-passes the background of frames with detections (see roi_filter.hpp)
+  encoder_pool(int32_t num_workers, const encode_policy &p, int32_t roi_factor = 0)
+      : policy(p), use_roi(roi_factor > 1), in_flight(0), running(true), stats() {
+    for (int32_t i = 0; i < std::max(num_workers, 1); ++i) {
+      states.emplace_back(new worker_state(roi_factor));
+      worker_state &st = *states.back();
+      st.rgb.set_decompositions(5);
+      st.rgb.set_block_size(64);
+      st.rgb.set_progression_order("RPCL");
+      st.ycbcr.set_decompositions(5);
+      st.ycbcr.set_block_size(64);
+      st.ycbcr.set_progression_order("RPCL");
+    }
+    for (auto &st : states) {
+      worker_state *s = st.get();
+      workers.emplace_back([this, s] { worker(*s); });
+    }
+  }
+
+  ~encoder_pool() { stop(); }
+
+  encoder_pool(const encoder_pool &)            = delete;
+  encoder_pool &operator=(const encoder_pool &) = delete;
+
+  std::future<encode_result> submit(const cv::Mat &frame, pixel_format format,
+                                    const std::vector<detection> &detections) {
+    job j;
+    j.frame                      = frame;
+    j.format                     = format;
+    j.detections                 = detections;
+    std::future<encode_result> f = j.promise.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      j.seq = stats.submitted++;
+      if (!running || in_flight >= policy.max_in_flight) {
+        stats.skipped++;
+        j.promise.set_value({j.seq, encode_outcome::skipped, 0, {}, 0.0});
+        return f;
+      }
+      j.downgraded = (in_flight >= policy.downgrade_depth);
+      j.qfactor    = j.downgraded ? policy.downgrade_qfactor : policy.qfactor;
+      in_flight++;
+      jobs.push_back(std::move(j));
+    }
+    cv_jobs.notify_one();
+    return f;
+  }
+
+  size_t num_workers() const { return workers.size(); }
+
+  encode_pool_stats get_stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    encode_pool_stats s = stats;
+    s.in_flight         = in_flight;
+    return s;
+  }
+
+  // Pending jobs are completed before the workers exit
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!running) {
+        return;
+      }
+      running = false;
+    }
+    cv_jobs.notify_all();
+    for (auto &th : workers) {
+      th.join();
+    }
+    workers.clear();
+  }
+
+ private:
+  void worker(worker_state &st) {
+    while (true) {
+      job j;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_jobs.wait(lock, [this] { return !jobs.empty() || !running; });
+        if (jobs.empty()) {
+          return;
+        }
+        j = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      encode_result r = encode(st, j);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        in_flight--;
+        switch (r.outcome) {
+          case encode_outcome::encoded:
+            stats.encoded++;
+            break;
+          case encode_outcome::downgraded:
+            stats.downgraded++;
+            break;
+          default:
+            stats.failed++;
+            break;
+        }
+      }
+      j.promise.set_value(std::move(r));
+    }
+  }
+
+  encode_result encode(worker_state &st, job &j) {
+    encode_result r = {j.seq, encode_outcome::failed, j.qfactor, {}, 0.0};
+    const auto t0   = std::chrono::high_resolution_clock::now();
+    try {
+      const cv::Mat &img = use_roi ? st.roi.apply(j.frame, j.format, j.detections) : j.frame;
+      if (j.format == pixel_format::i420) {
+        const int32_t w = img.cols, h = img.rows * 2 / 3;
+        const uint8_t *y = img.data, *u = y + w * h, *v = u + (w / 2) * (h / 2);
+        st.ycbcr.set_qfactor(j.qfactor);
+        r.codestream = st.ycbcr.encode(y, u, v, w, h, w, w / 2);
+      } else {
+        const image_view src = {img.data, img.cols, img.rows, static_cast<int32_t>(img.step[0]), 3, true};
+        // The result outlives the encoder buffer, which is overwritten by the next frame
+        const codestream_span cs = st.rgb.encode(src, j.qfactor);
+        r.codestream.assign(cs.begin(), cs.end());
+      }
+      r.outcome = j.downgraded ? encode_outcome::downgraded : encode_outcome::encoded;
+    } catch (...) {
+      r.codestream.clear();  // reported by the encoder
+    }
+    r.t_encode = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0)
+                     .count();
+    return r;
+  }
+};
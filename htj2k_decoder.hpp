@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <vector>
+#include <kdu_compressed.h>
+#include <kdu_params.h>
+#include <kdu_stripe_decompressor.h>
+#include "codec.h"
+
+/**************************************************************************************************
+  HTJ2K decoder to interleaved 8-bit RGB(A)
+
+  Decodes the codestreams written by the cameras: RGB frames (irreversible colour transform,
+  inverted by the decompressor) and YCbCr 4:2:0 frames, whose chroma is taken from the 2x2 block
+  of each luma sample and converted with the full range BT.601 matrix, as the detector does.
+  With discard levels > 0 only the lower resolutions are decoded: each level halves the size and
+  roughly quarters the work, which makes thumbnails cheap (frames have 5 DWT levels).
+  Component planes and the output image are kept between calls; the returned pixels are valid until
+  the next decode. Implements htj2k::Decoder (codec.h); width and height passed to it are the
+  expected full resolution size, 0 to accept any. Errors are reported by printing a message and
+  throwing std::exception.
+**************************************************************************************************/
+class htj2k_decoder : public htj2k::Decoder {
+ private:
+  int32_t discard_levels;
+  int32_t width;  // of the decoded image
+  int32_t height;
+  int32_t components;
+  bool ycbcr420;
+  std::vector<uint8_t> planes[4];
+  std::vector<uint8_t> pixels;
+
+ public:
+  htj2k_decoder() : discard_levels(0), width(0), height(0), components(0), ycbcr420(false) {}
+
+  // Number of highest resolution levels not decoded; limited to the levels of each codestream
+  void set_discard_levels(int32_t n) { discard_levels = std::max(n, 0); }
+
+  int32_t get_width() const { return width; }
+  int32_t get_height() const { return height; }
+  int32_t get_components() const { return components; }
+  bool is_ycbcr420() const { return ycbcr420; }
+
+  htj2k::PixelBuffer decodeRGB8(const uint8_t *codestream, size_t size, uint32_t w, uint32_t h,
+                                const uint8_t *, size_t) override {
+    return decode(codestream, size, w, h, 3);
+  }
+
+  htj2k::PixelBuffer decodeRGBA8(const uint8_t *codestream, size_t size, uint32_t w, uint32_t h,
+                                 const uint8_t *, size_t) override {
+    return decode(codestream, size, w, h, 4);
+  }
+
+ private:
+  htj2k::PixelBuffer decode(const uint8_t *codestream, size_t size, uint32_t expected_width,
+                            uint32_t expected_height, int32_t channels) {
+    kdu_core::kdu_compressed_source_buffered source(const_cast<kdu_byte *>(codestream),
+                                                    static_cast<kdu_long>(size));
+    kdu_core::kdu_codestream cs;
+    try {
+      cs.create(&source);
+      kdu_core::kdu_dims full;
+      cs.get_dims(0, full);
+      if ((expected_width && full.size.x != static_cast<int>(expected_width))
+          || (expected_height && full.size.y != static_cast<int>(expected_height))) {
+        printf("ERROR: codestream is %d x %d, expected %u x %u\n", full.size.x, full.size.y, expected_width,
+               expected_height);
+        throw std::exception();
+      }
+      const int32_t levels = std::min(discard_levels, cs.get_min_dwt_levels());
+      cs.apply_input_restrictions(0, 0, levels, 0, nullptr, KDU_WANT_OUTPUT_COMPONENTS);
+      components = std::min(cs.get_num_components(true), 4);
+
+      // Planar decoding of each component at its own size
+      kdu_byte *bufs[4];
+      int widths[4], heights[4], sample_gaps[4];
+      for (int32_t c = 0; c < components; ++c) {
+        kdu_core::kdu_dims dims;
+        cs.get_dims(c, dims, true);
+        widths[c]      = dims.size.x;
+        heights[c]     = dims.size.y;
+        sample_gaps[c] = 1;
+        planes[c].resize(static_cast<size_t>(widths[c]) * heights[c]);
+        bufs[c] = planes[c].data();
+      }
+      kdu_supp::kdu_stripe_decompressor decompressor;
+      decompressor.start(cs);
+      decompressor.pull_stripe(bufs, heights, sample_gaps, widths);
+      decompressor.finish();
+      cs.destroy();
+
+      width    = widths[0];
+      height   = heights[0];
+      ycbcr420 = (components == 3 && widths[1] < width);
+      interleave((components > 1) ? widths[1] : width, channels);
+    } catch (...) {
+      if (cs.exists()) {
+        cs.destroy();
+      }
+      printf("ERROR: HTJ2K decoding failed\n");
+      throw std::exception();
+    }
+    htj2k::PixelBuffer out;
+    out.width     = static_cast<uint32_t>(width);
+    out.height    = static_cast<uint32_t>(height);
+    out.num_comps = static_cast<uint8_t>(channels);
+    out.pixels    = pixels.data();
+    return out;
+  }
+
+  void interleave(int32_t chroma_width, int32_t channels) {
+    pixels.resize(static_cast<size_t>(width) * height * channels);
+    for (int32_t y = 0; y < height; ++y) {
+      uint8_t *dst = pixels.data() + static_cast<size_t>(y) * width * channels;
+      if (ycbcr420) {
+        const uint8_t *sy = planes[0].data() + static_cast<size_t>(y) * width;
+        const uint8_t *su = planes[1].data() + static_cast<size_t>(y / 2) * chroma_width;
+        const uint8_t *sv = planes[2].data() + static_cast<size_t>(y / 2) * chroma_width;
+        for (int32_t x = 0; x < width; ++x, dst += channels) {
+          const float luma = sy[x];
+          const float cb   = su[x / 2] - 128.0f;
+          const float cr   = sv[x / 2] - 128.0f;
+          dst[0]           = saturate(luma + 1.402f * cr);
+          dst[1]           = saturate(luma - 0.344136f * cb - 0.714136f * cr);
+          dst[2]           = saturate(luma + 1.772f * cb);
+          if (channels == 4) {
+            dst[3] = 255;
+          }
+        }
+        continue;
+      }
+      // Grayscale is replicated; a missing alpha is opaque
+      const size_t row = static_cast<size_t>(y) * width;
+      for (int32_t x = 0; x < width; ++x, dst += channels) {
+        for (int32_t c = 0; c < channels; ++c) {
+          dst[c] = (c < components) ? planes[c][row + x] : (c == 3) ? 255 : planes[0][row + x];
+        }
+      }
+    }
+  }
+
+  static uint8_t saturate(float v) {
+    return static_cast<uint8_t>(std::min(std::max(v + 0.5f, 0.0f), 255.0f));
+  }
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <kdu_compressed.h>
+#include <kdu_params.h>
+#include <kdu_stripe_compressor.h>
+#include "codec.h"
+
+// Interleaved 8-bit source image, e.g. a camera buffer; rows are `stride` bytes apart
+struct image_view {
+  const uint8_t *data;
+  int32_t width;
+  int32_t height;
+  int32_t stride;
+  int32_t channels;  // 3 or 4 (alpha last)
+  bool bgr;          // B, G, R order instead of R, G, B
+};
+
+// Read-only view of a codestream held by the encoder
+struct codestream_span {
+  const uint8_t *data;
+  size_t size;
+  const uint8_t *begin() const { return data; }
+  const uint8_t *end() const { return data + size; }
+  bool empty() const { return size == 0; }
+};
+
+/**************************************************************************************************
+  Reusable HTJ2K encoder for interleaved RGB(A)/BGR(A) images
+
+  Samples are handed to the stripe compressor straight from the source: every component gets its
+  own pointer into the interleaved rows, so BGR is reordered and strides are skipped on the fly,
+  without a converted copy of the image. For each resolution (and Qfactor, DWT depth) it keeps a
+  context: a codestream whose parameters are finalized once and restarted for every frame, the
+  stripe compressor driving it, and the buffer the codestream is written to, which keeps its
+  capacity. Once a context is warm, the wrapper itself makes no allocation; kakadu still builds its
+  analysis engines and sample buffers inside kdu_stripe_compressor::start() for every frame. The
+  result is a span over that buffer, valid until the next frame of the same resolution is encoded.
+  Implements htj2k::Encoder (codec.h). Errors are reported by printing a message and throwing
+  std::exception.
+**************************************************************************************************/
+class htj2k_encoder : public htj2k::Encoder {
+ private:
+  // Appends the codestream to a vector that keeps its capacity between frames
+  class vector_target : public kdu_core::kdu_compressed_target {
+   public:
+    std::vector<uint8_t> *buf = nullptr;
+    bool write(const kdu_byte *data, int num_bytes) override {
+      buf->insert(buf->end(), data, data + num_bytes);
+      return true;
+    }
+  };
+
+  struct context {
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t qfactor;
+    int32_t levels;
+    kdu_core::kdu_codestream cs;
+    std::unique_ptr<kdu_supp::kdu_stripe_compressor> compressor;  // re-started for every frame
+    vector_target target;
+    std::vector<uint8_t> out;
+    bool restartable;  // cs holds the finished previous frame
+    uint64_t last_use;
+  };
+
+  static constexpr size_t MAX_CONTEXTS = 4;
+
+  int32_t levels;
+  int32_t block_size;
+  std::string order;
+  std::vector<std::unique_ptr<context>> contexts;
+  uint64_t frames;
+
+ public:
+  htj2k_encoder() : levels(5), block_size(64), order("RPCL"), frames(0) { contexts.reserve(MAX_CONTEXTS); }
+
+  ~htj2k_encoder() override { reset(); }
+
+  htj2k_encoder(const htj2k_encoder &)            = delete;
+  htj2k_encoder &operator=(const htj2k_encoder &) = delete;
+
+  // The DWT depth is part of the context key, like the Qfactor; other parameters drop the contexts
+  void set_decompositions(int32_t n) { levels = n; }
+  void set_block_size(int32_t n) {
+    if (n != block_size) {
+      block_size = n;
+      reset();
+    }
+  }
+  void set_progression_order(const char *o) {
+    if (order != o) {
+      order = o;
+      reset();
+    }
+  }
+
+  void reset() {
+    for (auto &ctx : contexts) {
+      ctx->compressor.reset();
+      if (ctx->cs.exists()) {
+        ctx->cs.destroy();
+      }
+    }
+    contexts.clear();
+  }
+
+  codestream_span encode(const image_view &src, int32_t qfactor) {
+    context &ctx = get_context(src.width, src.height, src.channels, qfactor);
+    ctx.out.clear();
+    try {
+      if (ctx.restartable) {
+        ctx.cs.restart(&ctx.target);
+      } else {
+        create_codestream(ctx);
+      }
+      // One pointer per component into the interleaved rows; R and B are swapped for BGR sources
+      kdu_byte *planes[4];
+      int heights[4], sample_gaps[4], row_gaps[4];
+      for (int32_t c = 0; c < src.channels; ++c) {
+        const int32_t offset = (src.bgr && c < 3) ? 2 - c : c;
+        planes[c]            = const_cast<uint8_t *>(src.data) + offset;
+        heights[c]           = src.height;
+        sample_gaps[c]       = src.channels;
+        row_gaps[c]          = src.stride;
+      }
+      if (!ctx.compressor) {
+        ctx.compressor.reset(new kdu_supp::kdu_stripe_compressor);
+      }
+      ctx.compressor->start(ctx.cs);
+      ctx.compressor->push_stripe(planes, heights, sample_gaps, row_gaps);
+      ctx.compressor->finish();
+      ctx.restartable = true;
+    } catch (...) {
+      // Start the next frame of this resolution from scratch
+      ctx.compressor.reset();
+      if (ctx.cs.exists()) {
+        ctx.cs.destroy();
+      }
+      ctx.restartable = false;
+      printf("ERROR: HTJ2K encoding of a %d x %d frame failed\n", src.width, src.height);
+      throw std::exception();
+    }
+    return {ctx.out.data(), ctx.out.size()};
+  }
+
+  // htj2k::Encoder; the buffer belongs to the encoder (see encode())
+  htj2k::CodestreamBuffer encodeRGB8(const uint8_t *pixels, uint32_t width, uint32_t height,
+                                     uint8_t QF) override {
+    const int32_t w = static_cast<int32_t>(width), h = static_cast<int32_t>(height);
+    return to_buffer(encode({pixels, w, h, w * 3, 3, false}, QF));
+  }
+
+  htj2k::CodestreamBuffer encodeRGBA8(const uint8_t *pixels, uint32_t width, uint32_t height,
+                                      uint8_t QF) override {
+    const int32_t w = static_cast<int32_t>(width), h = static_cast<int32_t>(height);
+    return to_buffer(encode({pixels, w, h, w * 4, 4, false}, QF));
+  }
+
+ private:
+  static htj2k::CodestreamBuffer to_buffer(codestream_span s) {
+    htj2k::CodestreamBuffer b;
+    b.codestream = const_cast<uint8_t *>(s.data);
+    b.size       = s.size;
+    return b;
+  }
+
+  // Context of the resolution; the least recently used one is replaced when all are taken
+  context &get_context(int32_t width, int32_t height, int32_t channels, int32_t qfactor) {
+    ++frames;
+    context *lru = nullptr;
+    for (auto &ctx : contexts) {
+      if (ctx->width == width && ctx->height == height && ctx->channels == channels
+          && ctx->qfactor == qfactor && ctx->levels == levels) {
+        ctx->last_use = frames;
+        return *ctx;
+      }
+      if (lru == nullptr || ctx->last_use < lru->last_use) {
+        lru = ctx.get();
+      }
+    }
+    if (contexts.size() < MAX_CONTEXTS) {
+      contexts.emplace_back(new context);
+      lru = contexts.back().get();
+    } else {
+      lru->compressor.reset();
+      if (lru->cs.exists()) {
+        lru->cs.destroy();
+      }
+    }
+    lru->width       = width;
+    lru->height      = height;
+    lru->channels    = channels;
+    lru->qfactor     = qfactor;
+    lru->levels      = levels;
+    lru->target.buf  = &lru->out;
+    lru->restartable = false;
+    lru->last_use    = frames;
+    return *lru;
+  }
+
+  void create_codestream(context &ctx) {
+    kdu_core::siz_params siz;
+    siz.set(kdu_core::Scomponents, 0, 0, ctx.channels);
+    siz.set(kdu_core::Sprecision, 0, 0, 8);
+    siz.set(kdu_core::Ssigned, 0, 0, false);
+    siz.set(kdu_core::Sdims, 0, 0, ctx.height);
+    siz.set(kdu_core::Sdims, 0, 1, ctx.width);
+    siz.finalize();
+    ctx.cs.create(&siz, &ctx.target);
+    ctx.cs.enable_restart();
+
+    kdu_core::kdu_params *p = ctx.cs.access_siz();
+    p->parse_string("Cmodes=HT");
+    p->parse_string("Creversible=no");
+    p->parse_string("Cycc=yes");
+    p->parse_string(("Clevels=" + std::to_string(ctx.levels)).c_str());
+    p->parse_string(("Corder=" + order).c_str());
+    const std::string blk = std::to_string(block_size);
+    p->parse_string(("Cblk={" + blk + "," + blk + "}").c_str());
+    p->parse_string(("Qfactor=" + std::to_string(ctx.qfactor)).c_str());
+    p->finalize_all();
+  }
+};
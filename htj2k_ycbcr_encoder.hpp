@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+#include <kdu_compressed.h>
+#include <kdu_params.h>
+#include <kdu_stripe_compressor.h>
+
+/**************************************************************************************************
+  HTJ2K encoder for planar YCbCr 4:2:0 (I420)
+
+  The Y, Cb and Cr planes are coded as three components; the chroma components are declared with
+  2x2 sub-sampling in the SIZ marker, so nothing is up-sampled or converted to RGB and no colour
+  transform is applied. Planes are pushed to the stripe compressor straight from the source buffer
+  (e.g. a camera buffer); the row gaps take care of strides.
+  Errors are reported by printing a message and throwing std::exception.
+**************************************************************************************************/
+class htj2k_ycbcr_encoder {
+ private:
+  // Appends the codestream to a vector that keeps its capacity between frames
+  class vector_target : public kdu_core::kdu_compressed_target {
+   public:
+    std::vector<uint8_t> *buf = nullptr;
+    bool write(const kdu_byte *data, int num_bytes) override {
+      buf->insert(buf->end(), data, data + num_bytes);
+      return true;
+    }
+  };
+
+  int32_t qfactor;
+  int32_t levels;
+  int32_t block_size;
+  std::string order;
+  vector_target target;
+  std::vector<uint8_t> codestream;
+
+ public:
+  htj2k_ycbcr_encoder() : qfactor(85), levels(5), block_size(64), order("RPCL") {}
+
+  void set_qfactor(int32_t q) { qfactor = q; }
+  void set_decompositions(int32_t n) { levels = n; }
+  void set_block_size(int32_t n) { block_size = n; }
+  void set_progression_order(const char *o) { order = o; }
+
+  // Chroma planes are (width + 1) / 2 x (height + 1) / 2
+  const std::vector<uint8_t> &encode(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, int32_t width,
+                                     int32_t height, int32_t y_stride, int32_t c_stride) {
+    const int32_t cw = (width + 1) / 2, ch = (height + 1) / 2;
+    codestream.clear();
+    target.buf = &codestream;
+    kdu_core::kdu_codestream cs;
+    try {
+      kdu_core::siz_params siz;
+      siz.set(kdu_core::Scomponents, 0, 0, 3);
+      siz.set(kdu_core::Sprecision, 0, 0, 8);
+      siz.set(kdu_core::Ssigned, 0, 0, false);
+      siz.set(kdu_core::Sdims, 0, 0, height);
+      siz.set(kdu_core::Sdims, 0, 1, width);
+      for (int32_t c = 1; c < 3; ++c) {
+        siz.set(kdu_core::Sdims, c, 0, ch);
+        siz.set(kdu_core::Sdims, c, 1, cw);
+      }
+      siz.finalize();  // derives Ssize and Ssampling from Sdims
+      cs.create(&siz, &target);
+
+      kdu_core::kdu_params *p = cs.access_siz();
+      p->parse_string("Cmodes=HT");
+      p->parse_string("Creversible=no");
+      p->parse_string("Cycc=no");
+      p->parse_string(("Clevels=" + std::to_string(levels)).c_str());
+      p->parse_string(("Corder=" + order).c_str());
+      const std::string blk = std::to_string(block_size);
+      p->parse_string(("Cblk={" + blk + "," + blk + "}").c_str());
+      p->parse_string(("Qfactor=" + std::to_string(qfactor)).c_str());
+      p->finalize_all();
+
+      kdu_supp::kdu_stripe_compressor compressor;
+      compressor.start(cs);
+      kdu_byte *planes[3] = {const_cast<uint8_t *>(y), const_cast<uint8_t *>(cb),
+                             const_cast<uint8_t *>(cr)};
+      int heights[3]     = {height, ch, ch};
+      int sample_gaps[3] = {1, 1, 1};
+      int row_gaps[3]    = {y_stride, c_stride, c_stride};
+      compressor.push_stripe(planes, heights, sample_gaps, row_gaps);
+      compressor.finish();
+      cs.destroy();
+    } catch (...) {
+      if (cs.exists()) {
+        cs.destroy();
+      }
+      printf("ERROR: HTJ2K encoding of a YCbCr 4:2:0 frame failed\n");
+      throw std::exception();
+    }
+    return codestream;
+  }
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/dnn/dnn.hpp>
+#ifdef ENABLE_ONNXRUNTIME
+  #include <onnxruntime_cxx_api.h>
+#endif
+
+// Options of inference engines
+struct engine_options {
+  std::string backend;       // "opencv" or "onnxruntime"
+  std::string precision;     // "fp32", "fp16" or "int8"
+  int32_t intra_op_threads;  // 0: default of the engine
+  int32_t graph_opt_level;   // 0: disable, 1: basic, 2: extended, 3: all (onnxruntime only)
+
+  engine_options() : backend("opencv"), precision("fp32"), intra_op_threads(0), graph_opt_level(3) {}
+};
+
+/**************************************************************************************************
+  Interface of inference engines
+
+  forward() takes an N x 3 x H x W float blob and returns the first output of the network as a
+  float tensor of N x rows x (5 + number of classes), whatever the engine is, so that the
+  post-process is shared. The returned cv::Mat is owned by the engine and valid until the next
+  call of forward(). Errors are reported by printing a message and throwing std::exception.
+
+  Quantized (INT8, QDQ or QLinear operators) and FP16 ONNX models are loaded like FP32 ones;
+  precision selects the arithmetic where the engine lets us choose it.
+**************************************************************************************************/
+class inference_engine {
+ public:
+  virtual void load(const char *onnx_file) = 0;
+
+  virtual const cv::Mat &forward(const cv::Mat &blob) = 0;
+
+  // Time spent by the last forward() in milliseconds
+  virtual double get_inference_time() = 0;
+
+  virtual const char *name() const = 0;
+
+  virtual ~inference_engine() {}
+};
+
+/**************************************************************************************************
+  OpenCV DNN
+**************************************************************************************************/
+class opencv_dnn_engine : public inference_engine {
+ private:
+  const engine_options options;
+  cv::dnn::Net net;
+  std::vector<std::string> names;  // output layer names
+  std::vector<cv::Mat> outputs;
+
+ public:
+  explicit opencv_dnn_engine(const engine_options &opt) : options(opt) {}
+
+  void load(const char *onnx_file) override {
+    try {
+      this->net = cv::dnn::readNet(onnx_file);
+    } catch (std::exception &exc) {
+      printf("ERROR: could not find %s!\n", onnx_file);
+      throw std::exception();
+    }
+    this->net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    this->net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    if (options.precision == "fp16") {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 8)
+      // FP16 arithmetic on CPUs having it (e.g. Cortex-A76 of Raspberry Pi 5)
+      this->net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU_FP16);
+#else
+      printf("WARNING: FP16 inference requires OpenCV 4.8 or later, running in FP32\n");
+#endif
+    }
+    if (options.intra_op_threads > 0) {
+      // OpenCV has a single, process-wide thread pool
+      cv::setNumThreads(options.intra_op_threads);
+    }
+    std::vector<int32_t> out_layers       = net.getUnconnectedOutLayers();
+    std::vector<std::string> layers_names = net.getLayerNames();
+    names.resize(out_layers.size());
+    for (size_t i = 0; i < out_layers.size(); ++i) {
+      names[i] = layers_names[out_layers[i] - 1];
+    }
+  }
+
+  const cv::Mat &forward(const cv::Mat &blob) override {
+    this->net.setInput(blob);
+    this->net.forward(this->outputs, names[0]);
+    return this->outputs[0];
+  }
+
+  double get_inference_time() override {
+    // The function getPerfProfile returns the overall time for inference(t)
+    // and the timings for each of the layers(in layersTimes)
+    std::vector<double> layersTimes;
+    double freq = cv::getTickFrequency() / 1000;
+    return this->net.getPerfProfile(layersTimes) / freq;
+  }
+
+  const char *name() const override { return "opencv"; }
+
+  cv::dnn::Net &get_net() { return this->net; }
+};
+
+#ifdef ENABLE_ONNXRUNTIME
+/**************************************************************************************************
+  ONNX Runtime (CPU execution provider)
+
+  The output tensor is bound to a persistent cv::Mat once its shape is known, so that steady-state
+  inference writes straight into it.
+**************************************************************************************************/
+class onnxruntime_engine : public inference_engine {
+ private:
+  const engine_options options;
+  Ort::Env env;
+  std::unique_ptr<Ort::Session> session;
+  Ort::MemoryInfo memory_info;
+  std::string input_name, output_name;
+  bool fp16_input, fp16_output;       // models converted to FP16 including their inputs/outputs
+  std::vector<int64_t> input_shape;   // shape of the last input
+  std::vector<int64_t> output_shape;  // shape of the bound output
+  cv::Mat input_half;                 // FP16 copy of the input blob
+  cv::Mat output_half;                // FP16 output before conversion
+  cv::Mat output;
+  double t_infer;
+
+ public:
+  explicit onnxruntime_engine(const engine_options &opt)
+      : options(opt),
+        env(ORT_LOGGING_LEVEL_WARNING, "yolo"),
+        memory_info(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+        fp16_input(false),
+        fp16_output(false),
+        t_infer(0.0) {}
+
+  void load(const char *onnx_file) override {
+    Ort::SessionOptions so;
+    if (options.intra_op_threads > 0) {
+      so.SetIntraOpNumThreads(options.intra_op_threads);
+    }
+    so.SetInterOpNumThreads(1);
+    so.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
+    so.SetGraphOptimizationLevel(graph_optimization_level(options.graph_opt_level));
+    try {
+      session = std::make_unique<Ort::Session>(env, onnx_file, so);
+    } catch (Ort::Exception &exc) {
+      printf("ERROR: could not load %s (%s)\n", onnx_file, exc.what());
+      throw std::exception();
+    }
+    Ort::AllocatorWithDefaultOptions allocator;
+    input_name  = session->GetInputNameAllocated(0, allocator).get();
+    output_name = session->GetOutputNameAllocated(0, allocator).get();
+    fp16_input  = session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType()
+                  == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    fp16_output = session->GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType()
+                  == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+  }
+
+  const cv::Mat &forward(const cv::Mat &blob) override {
+    std::vector<int64_t> shape(blob.dims);
+    for (int32_t i = 0; i < blob.dims; ++i) {
+      shape[i] = blob.size[i];
+    }
+    const cv::Mat *src = &blob;
+    if (fp16_input) {
+      blob.convertTo(input_half, CV_16F);
+      src = &input_half;
+    }
+    Ort::Value in = make_tensor(*src, shape);
+    const char *in_names[]  = {input_name.c_str()};
+    const char *out_names[] = {output_name.c_str()};
+
+    auto t0 = std::chrono::steady_clock::now();
+    try {
+      if (shape == input_shape && !output.empty()) {
+        // Steady state: write into the bound output
+        Ort::Value out = make_tensor(fp16_output ? output_half : output, output_shape);
+        session->Run(Ort::RunOptions{nullptr}, in_names, &in, 1, out_names, &out, 1);
+      } else {
+        // First run or new input shape: let the runtime allocate and learn the output shape
+        std::vector<Ort::Value> outs =
+            session->Run(Ort::RunOptions{nullptr}, in_names, &in, 1, out_names, 1);
+        output_shape = outs[0].GetTensorTypeAndShapeInfo().GetShape();
+        std::vector<int32_t> sz(output_shape.begin(), output_shape.end());
+        output.create(static_cast<int32_t>(sz.size()), sz.data(), CV_32F);
+        if (fp16_output) {
+          output_half.create(static_cast<int32_t>(sz.size()), sz.data(), CV_16F);
+        }
+        cv::Mat &dst = fp16_output ? output_half : output;
+        std::memcpy(dst.data, outs[0].GetTensorRawData(), dst.total() * dst.elemSize());
+        input_shape = shape;
+      }
+    } catch (Ort::Exception &exc) {
+      printf("ERROR: inference failed (%s)\n", exc.what());
+      throw std::exception();
+    }
+    if (fp16_output) {
+      output_half.convertTo(output, CV_32F);
+    }
+    t_infer = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return output;
+  }
+
+  double get_inference_time() override { return t_infer; }
+
+  const char *name() const override { return "onnxruntime"; }
+
+ private:
+  Ort::Value make_tensor(const cv::Mat &m, const std::vector<int64_t> &shape) {
+    const ONNXTensorElementDataType type =
+        (m.depth() == CV_16F) ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+    return Ort::Value::CreateTensor(memory_info, m.data, m.total() * m.elemSize(), shape.data(),
+                                    shape.size(), type);
+  }
+
+  static GraphOptimizationLevel graph_optimization_level(int32_t level) {
+    switch (level) {
+      case 0:
+        return GraphOptimizationLevel::ORT_DISABLE_ALL;
+      case 1:
+        return GraphOptimizationLevel::ORT_ENABLE_BASIC;
+      case 2:
+        return GraphOptimizationLevel::ORT_ENABLE_EXTENDED;
+      default:
+        return GraphOptimizationLevel::ORT_ENABLE_ALL;
+    }
+  }
+};
+#endif
+
+// Create an engine by the name of its backend
+inline std::unique_ptr<inference_engine> create_inference_engine(const engine_options &opt) {
+  if (opt.backend == "opencv") {
+    return std::unique_ptr<inference_engine>(new opencv_dnn_engine(opt));
+  }
+#ifdef ENABLE_ONNXRUNTIME
+  if (opt.backend == "onnxruntime") {
+    return std::unique_ptr<inference_engine>(new onnxruntime_engine(opt));
+  }
+#endif
+  printf("ERROR: unsupported inference backend %s\n", opt.backend.c_str());
+  throw std::exception();
+}
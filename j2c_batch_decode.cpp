@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "htj2k_decoder.hpp"
+
+/**************************************************************************************************
+  Batch decoding and verification of archived codestreams
+
+  Decodes every .j2c file of a directory (e.g. written by j2c_server) on several threads, each with
+  its own decoder, and reports failures, sizes and decoding speed. With discard levels > 0 only
+  the lower resolutions are decoded (1/2, 1/4, ... of the frame size), which is the fast way to
+  make thumbnails. Decoded images are written as PNG if an output directory is given ("-" for
+  none). If a source directory is given, a frame <name>.j2c is compared with <name>.png (or .ppm,
+  .bmp, .jpg) there, scaled down to the decoded size, and the PSNR is reported.
+
+  usage: j2c_batch_decode <codestream directory> [discard levels] [output directory]
+                          [source directory] [threads]
+**************************************************************************************************/
+
+/* ========================================================================= */
+/*                         Set up messaging services                         */
+/* ========================================================================= */
+
+// Kakadu throws after an error message has been delivered; decoders catch it per file
+class kdu_stream_message : public kdu_core::kdu_thread_safe_message {
+ public:
+  kdu_stream_message(std::ostream *stream) { this->stream = stream; }
+  void put_text(const char *string) { (*stream) << string; }
+  void flush(bool end_of_message = false) {
+    stream->flush();
+    kdu_thread_safe_message::flush(end_of_message);
+  }
+
+ private:
+  std::ostream *stream;
+};
+
+static kdu_stream_message cerr_message(&std::cerr);
+static kdu_core::kdu_message_formatter pretty_cerr(&cerr_message);
+
+struct decode_result {
+  bool ok;
+  int32_t width;
+  int32_t height;
+  size_t bytes;
+  double t_decode;  // [ms]
+  double psnr;      // [dB], < 0 without a source frame
+};
+
+static bool read_file(const std::filesystem::path &path, std::vector<uint8_t> &data) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static cv::Mat read_source(const std::filesystem::path &dir, const std::string &stem) {
+  for (const char *ext : {".png", ".ppm", ".bmp", ".jpg"}) {
+    const std::filesystem::path p = dir / (stem + ext);
+    if (std::filesystem::exists(p)) {
+      return cv::imread(p.string(), cv::IMREAD_COLOR);
+    }
+  }
+  return cv::Mat();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <codestream directory> [discard levels] [output directory] [source directory] "
+           "[threads]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  const std::filesystem::path input_dir(argv[1]);
+  const int32_t discard_levels = (argc > 2) ? std::atoi(argv[2]) : 0;
+  const std::string output_dir = (argc > 3) ? argv[3] : "-";
+  const std::string source_dir = (argc > 4) ? argv[4] : "";
+  const int32_t hw_threads     = static_cast<int32_t>(std::thread::hardware_concurrency());
+  const int32_t num_threads    = std::max((argc > 5) ? std::atoi(argv[5]) : hw_threads, 1);
+
+  std::vector<std::filesystem::path> files;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(input_dir, ec)) {
+    if (entry.path().extension() == ".j2c") {
+      files.push_back(entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  if (files.empty()) {
+    printf("ERROR: no codestreams found in %s\n", input_dir.c_str());
+    return EXIT_FAILURE;
+  }
+  if (output_dir != "-") {
+    std::filesystem::create_directories(output_dir);
+  }
+  kdu_core::kdu_customize_errors(&pretty_cerr);
+
+  std::vector<decode_result> results(files.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&] {
+    htj2k_decoder decoder;
+    decoder.set_discard_levels(discard_levels);
+    std::vector<uint8_t> codestream;
+    cv::Mat bgr;
+    for (size_t i = next++; i < files.size(); i = next++) {
+      decode_result &r = results[i];
+      r                = {false, 0, 0, 0, 0.0, -1.0};
+      if (!read_file(files[i], codestream)) {
+        printf("ERROR: could not read %s\n", files[i].c_str());
+        continue;
+      }
+      r.bytes       = codestream.size();
+      const auto t0 = std::chrono::high_resolution_clock::now();
+      htj2k::PixelBuffer px;
+      try {
+        px = decoder.decodeRGB8(codestream.data(), codestream.size(), 0, 0, nullptr, 0);
+      } catch (std::exception &exc) {
+        printf("ERROR: could not decode %s\n", files[i].c_str());
+        continue;
+      }
+      r.t_decode = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0)
+                       .count();
+      r.ok       = true;
+      r.width    = static_cast<int32_t>(px.width);
+      r.height   = static_cast<int32_t>(px.height);
+
+      if (output_dir == "-" && source_dir.empty()) {
+        continue;
+      }
+      cv::cvtColor(cv::Mat(r.height, r.width, CV_8UC3, px.pixels), bgr, cv::COLOR_RGB2BGR);
+      const std::string stem = files[i].stem().string();
+      if (output_dir != "-") {
+        cv::imwrite((std::filesystem::path(output_dir) / (stem + ".png")).string(), bgr);
+      }
+      if (!source_dir.empty()) {
+        cv::Mat src = read_source(source_dir, stem);
+        if (src.empty()) {
+          continue;
+        }
+        if (src.size() != bgr.size()) {
+          cv::resize(src, src, bgr.size(), 0, 0, cv::INTER_AREA);
+        }
+        r.psnr = cv::PSNR(src, bgr);
+      }
+    }
+  };
+
+  const auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back(worker);
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  size_t decoded = 0, bytes = 0, compared = 0;
+  double t_decode = 0.0, psnr_sum = 0.0, psnr_min = 1e9;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const decode_result &r = results[i];
+    if (!r.ok) {
+      continue;
+    }
+    decoded++;
+    bytes += r.bytes;
+    t_decode += r.t_decode;
+    if (r.psnr >= 0.0) {
+      printf("%s: %d x %d, %zu bytes, PSNR %.2f dB\n", files[i].filename().c_str(), r.width, r.height,
+             r.bytes, r.psnr);
+      compared++;
+      psnr_sum += r.psnr;
+      psnr_min = std::min(psnr_min, r.psnr);
+    }
+  }
+  printf("%zu of %zu codestreams decoded (%zu failed), %d levels discarded, %d threads\n", decoded,
+         files.size(), files.size() - decoded, std::max(discard_levels, 0), num_threads);
+  if (decoded > 0) {
+    printf("decoding: %.2f ms per codestream on average, %.1f codestreams/s, %.1f MB/s\n",
+           t_decode / decoded, decoded / seconds, bytes / seconds / (1 << 20));
+  }
+  if (compared > 0) {
+    printf("PSNR against %zu source frames: %.2f dB on average, %.2f dB min\n", compared,
+           psnr_sum / compared, psnr_min);
+  }
+  return (decoded == files.size()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
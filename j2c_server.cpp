@@ -0,0 +1,416 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "create_filename.hpp"
+#include "spsc_queue.hpp"
+#include "wire_protocol.hpp"
+
+/**************************************************************************************************
+  Receiver of framed codestreams (see wire_protocol.hpp) from many cameras
+
+  One thread multiplexes all connections with epoll. Each connection reads the header of a frame
+  into a small buffer and then the codestream straight into a pooled buffer of the right size, so
+  payload bytes are copied once, from the socket into their final buffer. Complete frames are
+  handed to a writer thread that stores them as <address>_<camera id>_<seq>_<time>.j2c and returns the
+  buffers to the pool. When the disk cannot keep up the handoff blocks, the sockets stop being
+  read and TCP pushes back on the cameras.
+
+  usage: j2c_server [port] [output directory] [report interval in s]
+**************************************************************************************************/
+
+static std::atomic<bool> g_running(true);
+
+static void on_signal(int) { g_running = false; }
+
+// Payload buffer that is not zero-filled on allocation
+struct frame_buffer {
+  std::unique_ptr<uint8_t[]> data;
+  size_t capacity = 0;
+  size_t length   = 0;
+};
+using buffer_ptr = std::unique_ptr<frame_buffer>;
+
+/**************************************************************************************************
+  Pool of payload buffers shared by the network and the writer threads
+
+  acquire() returns a released buffer large enough for the request if there is one, otherwise
+  grows one; buffers are only freed when the pool holds more than max_free of them.
+**************************************************************************************************/
+class buffer_pool {
+ private:
+  std::mutex mtx;
+  std::vector<buffer_ptr> free_list;
+  const size_t max_free;
+
+ public:
+  explicit buffer_pool(size_t max_free_buffers) : max_free(max_free_buffers) {}
+
+  buffer_ptr acquire(size_t length) {
+    buffer_ptr b;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      // Smallest buffer that fits, else the largest one (regrown below)
+      size_t best = free_list.size(), largest = free_list.size();
+      for (size_t i = 0; i < free_list.size(); ++i) {
+        const size_t cap = free_list[i]->capacity;
+        if (cap >= length && (best == free_list.size() || cap < free_list[best]->capacity)) {
+          best = i;
+        }
+        if (largest == free_list.size() || cap > free_list[largest]->capacity) {
+          largest = i;
+        }
+      }
+      if (best == free_list.size()) {
+        best = largest;
+      }
+      if (best < free_list.size()) {
+        b               = std::move(free_list[best]);
+        free_list[best] = std::move(free_list.back());
+        free_list.pop_back();
+      }
+    }
+    if (!b) {
+      b.reset(new frame_buffer);
+    }
+    if (b->capacity < length) {
+      b->data.reset(new uint8_t[length]);
+      b->capacity = length;
+    }
+    b->length = length;
+    return b;
+  }
+
+  void release(buffer_ptr b) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (free_list.size() < max_free) {
+      free_list.push_back(std::move(b));
+    }
+  }
+};
+
+struct received_frame {
+  std::string source;  // <address>_<camera id>
+  wire_frame_info info;
+  buffer_ptr payload;
+};
+
+// Counters of one camera, updated by the network thread
+struct camera_stats {
+  uint64_t frames     = 0;
+  uint64_t bytes      = 0;
+  uint64_t frames_rep = 0;  // values at the last report
+  uint64_t bytes_rep  = 0;
+  uint64_t last_seq   = 0;
+  uint64_t gaps       = 0;  // frames missing according to sequence numbers
+};
+
+class connection {
+ public:
+  enum class state { header, payload };
+
+  int fd;
+  std::string address;
+  state st;
+  std::vector<uint8_t> header;  // fixed part and detections
+  size_t filled;                // bytes of the header or of the payload received so far
+  wire_frame_info info;
+  buffer_ptr payload;
+
+  connection(int s, const std::string &addr) : fd(s), address(addr), st(state::header), filled(0) {
+    header.resize(WIRE_FIXED_SIZE);
+  }
+  ~connection() { close(fd); }
+};
+
+class j2c_server {
+ private:
+  static constexpr int MAX_EVENTS      = 64;
+  static constexpr int READS_PER_EVENT = 4;  // fairness between connections
+  static constexpr size_t WRITE_QUEUE  = 32;
+
+  int listen_fd;
+  int epoll_fd;
+  std::filesystem::path output_dir;
+  std::unordered_map<int, std::unique_ptr<connection>> connections;
+  std::map<std::string, camera_stats> cameras;
+  buffer_pool pool;
+  spsc_queue<received_frame> write_queue;
+  std::thread writer;
+  std::atomic<uint64_t> write_errors;
+  uint64_t accepted, protocol_errors;
+
+ public:
+  j2c_server(int port, const std::filesystem::path &dir)
+      : listen_fd(-1),
+        epoll_fd(-1),
+        output_dir(dir),
+        pool(2 * WRITE_QUEUE),
+        write_queue(WRITE_QUEUE, queue_policy::block),
+        write_errors(0),
+        accepted(0),
+        protocol_errors(0) {
+    std::error_code ec;
+    std::filesystem::create_directories(output_dir, ec);
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int opt   = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(port);
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+        || listen(listen_fd, SOMAXCONN) != 0) {
+      printf("ERROR: cannot listen on port %d (%s)\n", port, strerror(errno));
+      throw std::exception();
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    watch(listen_fd);
+    writer = std::thread([this] { write_frames(); });
+  }
+
+  ~j2c_server() {
+    write_queue.close();
+    writer.join();
+    connections.clear();
+    close(epoll_fd);
+    close(listen_fd);
+  }
+
+  void run(int32_t report_interval_s) {
+    epoll_event events[MAX_EVENTS];
+    auto t_report = std::chrono::steady_clock::now();
+    while (g_running) {
+      const int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 500);
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == listen_fd) {
+          accept_clients();
+          continue;
+        }
+        auto it = connections.find(fd);
+        if (it != connections.end() && !read_connection(*it->second)) {
+          drop(fd);
+        }
+      }
+      const auto now       = std::chrono::steady_clock::now();
+      const double elapsed = std::chrono::duration<double>(now - t_report).count();
+      if (report_interval_s > 0 && elapsed >= report_interval_s) {
+        report(elapsed);
+        t_report = now;
+      }
+    }
+  }
+
+ private:
+  void watch(int fd) {
+    epoll_event ev = {};
+    ev.events      = EPOLLIN;
+    ev.data.fd     = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  void accept_clients() {
+    while (true) {
+      sockaddr_in from;
+      socklen_t len = sizeof(from);
+      const int fd =
+          accept4(listen_fd, reinterpret_cast<sockaddr *>(&from), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      char name[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &from.sin_addr, name, sizeof(name));
+      // Codestreams are large: let the kernel buffer a good part of one
+      int rcvbuf = 4 << 20;
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+      connections[fd].reset(new connection(fd, name));
+      watch(fd);
+      accepted++;
+      printf("%s connected (%zu connections)\n", name, connections.size());
+    }
+  }
+
+  void drop(int fd) {
+    auto it = connections.find(fd);
+    printf("%s disconnected\n", it->second->address.c_str());
+    if (it->second->payload) {
+      pool.release(std::move(it->second->payload));
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    connections.erase(it);
+  }
+
+  // false when the connection has to be closed
+  bool read_connection(connection &c) {
+    for (int32_t i = 0; i < READS_PER_EVENT; ++i) {
+      uint8_t *dst;
+      size_t want;
+      if (c.st == connection::state::header) {
+        dst  = c.header.data() + c.filled;
+        want = c.header.size() - c.filled;
+      } else {
+        dst  = c.payload->data.get() + c.filled;
+        want = c.payload->length - c.filled;
+      }
+      const ssize_t r = recv(c.fd, dst, want, 0);
+      if (r == 0) {
+        return false;
+      }
+      if (r < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+      c.filled += static_cast<size_t>(r);
+      if (c.st == connection::state::header) {
+        if (c.filled == c.header.size() && !parse_header(c)) {
+          return false;
+        }
+      } else if (c.filled == c.payload->length) {
+        complete_frame(c);
+      }
+    }
+    return true;
+  }
+
+  bool parse_header(connection &c) {
+    size_t header_length    = 0;
+    uint32_t payload_length = 0;
+    const wire_status st =
+        wire_decode_header(c.header.data(), c.filled, c.info, header_length, payload_length);
+    if (st == wire_status::need_more) {
+      c.header.resize(header_length);  // detections follow the fixed part
+      return true;
+    }
+    if (st != wire_status::ok) {
+      printf("ERROR: %s sent a malformed frame (status %d)\n", c.address.c_str(), static_cast<int>(st));
+      protocol_errors++;
+      return false;
+    }
+    c.payload = pool.acquire(payload_length);
+    c.st      = connection::state::payload;
+    c.filled  = 0;
+    if (payload_length == 0) {
+      complete_frame(c);
+    }
+    return true;
+  }
+
+  void complete_frame(connection &c) {
+    received_frame f;
+    f.source  = c.address + "_" + std::to_string(c.info.camera_id);
+    f.info    = c.info;
+    f.payload = std::move(c.payload);
+
+    camera_stats &cs = cameras[f.source];
+    if (cs.frames > 0 && c.info.seq > cs.last_seq + 1) {
+      cs.gaps += c.info.seq - cs.last_seq - 1;
+    }
+    cs.last_seq = c.info.seq;
+    cs.frames++;
+    cs.bytes += f.payload->length;
+
+    write_queue.push(std::move(f));
+    c.st     = connection::state::header;
+    c.filled = 0;
+    c.header.resize(WIRE_FIXED_SIZE);
+  }
+
+  // Creates a file that does not exist yet; a name already taken gets a numbered suffix instead of
+  // being overwritten
+  static FILE *create_new_file(const std::filesystem::path &dir, const std::string &name) {
+    const size_t dot       = name.rfind('.');
+    const std::string stem = name.substr(0, dot), ext = (dot == std::string::npos) ? "" : name.substr(dot);
+    for (int32_t n = 0; n < 100; ++n) {
+      const std::string fname = (n == 0) ? name : stem + "_" + std::to_string(n) + ext;
+      FILE *fp                = fopen((dir / fname).c_str(), "wbx");
+      if (fp != nullptr || errno != EEXIST) {
+        return fp;
+      }
+    }
+    return nullptr;
+  }
+
+  void write_frames() {
+    received_frame f;
+    while (!write_queue.is_closed() || !write_queue.empty()) {
+      if (!write_queue.pop(f)) continue;
+      // Several frames of a camera may arrive within a millisecond, and the crops of a frame share its
+      // seq: crops are named after their origin and detection as well
+      std::string prefix = f.source + "_" + std::to_string(f.info.seq) + "_";
+      if (f.info.is_crop) {
+        char crop[64];
+        snprintf(crop, sizeof(crop), "crop%ux%u_", f.info.crop_x, f.info.crop_y);
+        prefix += crop;
+        if (!f.info.detections.empty()) {
+          const wire_detection &d = f.info.detections[0];
+          snprintf(crop, sizeof(crop), "%u_%.2f_", d.class_id, d.score);
+          prefix += crop;
+        }
+      }
+      FILE *fp = create_new_file(output_dir, prefix + create_filename_based_on_time());
+      if (fp == nullptr || fwrite(f.payload->data.get(), 1, f.payload->length, fp) != f.payload->length) {
+        write_errors.fetch_add(1);
+      }
+      if (fp != nullptr) {
+        fclose(fp);
+      }
+      pool.release(std::move(f.payload));
+    }
+  }
+
+  void report(double elapsed) {
+    const queue_stats q = write_queue.get_stats();
+    printf("%zu connections, %lu accepted, %lu protocol errors, %lu write errors, write queue %zu\n",
+           connections.size(), static_cast<unsigned long>(accepted),
+           static_cast<unsigned long>(protocol_errors), static_cast<unsigned long>(write_errors.load()),
+           q.depth);
+    for (auto &kv : cameras) {
+      camera_stats &cs = kv.second;
+      printf("  %-24s %6.1f frames/s %8.2f MB/s  total %lu frames %.1f MB, %lu missing\n",
+             kv.first.c_str(), (cs.frames - cs.frames_rep) / elapsed,
+             (cs.bytes - cs.bytes_rep) / elapsed / (1 << 20),
+             static_cast<unsigned long>(cs.frames), cs.bytes / static_cast<double>(1 << 20),
+             static_cast<unsigned long>(cs.gaps));
+      cs.frames_rep = cs.frames;
+      cs.bytes_rep  = cs.bytes;
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  const int port                  = (argc > 1) ? std::atoi(argv[1]) : 4001;
+  const std::filesystem::path dir = (argc > 2) ? argv[2] : ".";
+  const int32_t interval          = (argc > 3) ? std::atoi(argv[3]) : 5;
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+  std::signal(SIGPIPE, SIG_IGN);
+  try {
+    j2c_server server(port, dir);
+    printf("listening on port %d, writing to %s\n", port, dir.c_str());
+    server.run(interval);
+  } catch (std::exception &) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,13 +1,29 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-
-#include <HTJ2KEncoder.hpp>
+#include <csignal>
+#include <deque>
+#include <future>
+#include <thread>
+#include "encoder_pool.hpp"
+#include <cstdlib>
 #include <cstring>
 #include "yolo.hpp"
 #include <opencv2/highgui.hpp>
 #include "LibCamera.h"
-#include "simple_tcp.hpp"
+#include "crop_encoder.hpp"
+#include "motion_gate.hpp"
+#include "roi_filter.hpp"
+#include "tcp_sender.hpp"
+#include "tracker.hpp"
+#include "wire_protocol.hpp"
 #include "create_filename.hpp"
+#ifdef ENABLE_MULTITHREAD
+  #include "spsc_queue.hpp"
+  #include "yolo_async.hpp"
+#endif
 
+#include "capture_config.hpp"
 #include "model_config.hpp"
 
 /* ========================================================================= */
@@ -32,20 +48,245 @@ static kdu_stream_message cerr_message(&std::cerr);
 static kdu_core::kdu_message_formatter pretty_cout(&cout_message);
 static kdu_core::kdu_message_formatter pretty_cerr(&cerr_message);
 
+// Cleared by SIGINT/SIGTERM, so that queued frames are encoded and sent and the camera is closed
+static std::atomic<bool> g_running(true);
+
+static void on_signal(int) { g_running = false; }
+
+/*************************************************************************************************/
+// Pipeline stages
+/*************************************************************************************************/
+// Output of the detection stage
+struct detected_frame {
+  uint64_t seq;
+  uint64_t timestamp_us;                    // capture time [us since the Unix epoch]
+  cv::Mat frame;                            // image for detection and display
+  pixel_format format;                      // layout of frame (BGR or I420)
+  std::shared_ptr<LibcameraFrame> capture;  // camera buffers held for the encode stream, if separate
+  std::vector<detection> detections;        // in frame coordinates
+  std::vector<uint32_t> track_ids;          // of the detections, when tracking
+  int32_t trigger;
+  double t_infer;
+};
+
+// Output of the encoding stage
+struct encoded_frame {
+  wire_frame_info info;  // header sent along with the codestream
+  std::vector<uint8_t> codestream;
+  double t_encode;
+};
+
+// View of a stream of a captured frame; RGB888 of libcamera is B, G, R in memory.
+// YUV420 is returned as one I420 Mat, which is a view if the planes are packed back to back.
+static cv::Mat stream_image(const LibCamera &cam, const LibcameraFrame &frame, int stream,
+                            pixel_format format) {
+  const libcamera::Size size = cam.getSize(stream);
+  const size_t stride        = cam.getStride(stream);
+  const int32_t w = size.width, h = size.height;
+  if (format == pixel_format::bgr) {
+    return cv::Mat(h, w, CV_8UC3, frame.data(stream), stride);
+  }
+  uint8_t *y = frame.data(stream, 0), *u = frame.data(stream, 1), *v = frame.data(stream, 2);
+  if (stride == static_cast<size_t>(w) && u == y + stride * h && v == u + stride / 2 * (h / 2)) {
+    return cv::Mat(h * 3 / 2, w, CV_8UC1, y);
+  }
+  cv::Mat i420(h * 3 / 2, w, CV_8UC1);
+  cv::Mat(h, w, CV_8UC1, y, stride).copyTo(i420.rowRange(0, h));
+  uint8_t *dst_u = i420.ptr<uint8_t>(h), *dst_v = dst_u + (w / 2) * (h / 2);
+  for (int32_t i = 0; i < h / 2; ++i) {
+    std::memcpy(dst_u + i * (w / 2), u + i * (stride / 2), w / 2);
+    std::memcpy(dst_v + i * (w / 2), v + i * (stride / 2), w / 2);
+  }
+  return i420;
+}
+
+// Object detection by YOLOv5
+static void detect_frame(yolo_class &yolo, detected_frame &df) {
+  df.detections = yolo.detect(df.frame, df.format);
+  df.trigger    = yolo.get_aftrigger();
+  df.t_infer    = yolo.get_inference_time();
+}
+
+// Tracked objects replace the detections; the trigger fires once per person, when it is confirmed
+static void apply_tracks(const tracker &trk, detected_frame &df) {
+  df.detections.clear();
+  df.track_ids.clear();
+  for (const auto &o : trk.get_objects()) {
+    df.detections.push_back({o.class_id, o.score, o.box});
+    df.track_ids.push_back(o.id);
+  }
+  df.trigger = trk.has_new(0) ? 1 : 0;
+}
+
+static cv::Size image_size(const cv::Mat &img, pixel_format format) {
+  return cv::Size(img.cols, (format == pixel_format::i420) ? img.rows * 2 / 3 : img.rows);
+}
+
+// Job for the encoder: the image to encode with the detections mapped onto it (the detection and
+// encode images differ in size with two streams)
+static detected_frame make_encode_job(const detected_frame &df, const cv::Mat &image) {
+  detected_frame job;
+  job.seq            = df.seq;
+  job.timestamp_us   = df.timestamp_us;
+  job.frame          = image;
+  job.format         = df.format;
+  job.trigger        = df.trigger;
+  job.t_infer        = df.t_infer;
+  const cv::Size src = image_size(df.frame, df.format);
+  const cv::Size dst = image_size(image, df.format);
+  const float sx     = static_cast<float>(dst.width) / src.width;
+  const float sy     = static_cast<float>(dst.height) / src.height;
+  for (const auto &d : df.detections) {
+    const cv::Rect box(cvRound(d.box.x * sx), cvRound(d.box.y * sy), cvRound(d.box.width * sx),
+                       cvRound(d.box.height * sy));
+    job.detections.push_back({d.class_id, d.score, box});
+  }
+  return job;
+}
+
+// Header of an encoded frame
+static void describe_frame(const detected_frame &job, int32_t qfactor, encoded_frame &ef) {
+  const cv::Size size   = image_size(job.frame, job.format);
+  const bool ycbcr      = (job.format == pixel_format::i420);
+  wire_frame_info &info = ef.info;
+  info.seq              = job.seq;
+  info.timestamp_us     = job.timestamp_us;
+  info.width            = static_cast<uint16_t>(size.width);
+  info.height           = static_cast<uint16_t>(size.height);
+  info.components       = 3;
+  info.format           = ycbcr ? wire_pixel_format::ycbcr420 : wire_pixel_format::rgb;
+  info.qfactor          = static_cast<uint8_t>(qfactor);
+  info.levels           = 5;
+  info.block_size_log2  = 6;  // 64 x 64
+  info.detections.clear();
+  for (const auto &d : job.detections) {
+    info.detections.push_back({static_cast<uint16_t>(d.class_id), d.score, d.box.x, d.box.y, d.box.width,
+                               d.box.height});
+  }
+}
+
+// Header of the codestream of one detected object: the crop carries its origin in the frame and the
+// detection that produced it, in frame coordinates
+static void describe_crop(const detected_frame &job, int32_t qfactor, const encoded_crop &c,
+                          encoded_frame &ef) {
+  describe_frame(job, qfactor, ef);
+  const cv::Size size   = image_size(job.frame, job.format);
+  wire_frame_info &info = ef.info;
+  info.is_crop          = true;
+  info.crop_x           = static_cast<uint16_t>(c.crop.x);
+  info.crop_y           = static_cast<uint16_t>(c.crop.y);
+  info.frame_width      = static_cast<uint16_t>(size.width);
+  info.frame_height     = static_cast<uint16_t>(size.height);
+  info.width            = static_cast<uint16_t>(c.crop.width);
+  info.height           = static_cast<uint16_t>(c.crop.height);
+  info.levels           = static_cast<uint8_t>(c.levels);
+  info.detections.assign(1, {static_cast<uint16_t>(c.class_id), c.score, c.box.x, c.box.y, c.box.width,
+                             c.box.height});
+}
+
+// send codestream via the persistent TCP connection; never blocks
+static void send_codestream(tcp_sender &sender, encoded_frame &ef) {
+  std::vector<uint8_t> header;
+  wire_encode_header(ef.info, static_cast<uint32_t>(ef.codestream.size()), header);
+  sender.send(std::move(header), std::move(ef.codestream));
+}
+
+// Get temperature
+static float read_temperature() {
+  FILE *fp;
+  char temp_read[16] = "";
+  fp                 = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
+  if (fp == nullptr) {
+    return 0.0f;
+  }
+  fgets(temp_read, 16, fp);
+  fclose(fp);
+  return std::stoi(temp_read, nullptr, 10) / 1000.0f;
+}
+
+static void put_inference_info(cv::Mat &output_image, const char *onnx_file, double t) {
+  std::string label_yolo = cv::format("Model: %s , Inference time: %6.2f ms", onnx_file, t);
+  cv::putText(output_image, label_yolo, cv::Point(20, 40), FONT_FACE, FONT_SCALE, WHITE, 2);
+}
+
+static void put_status_info(cv::Mat &output_image, const std::string &label_htj2k) {
+  cv::putText(output_image, label_htj2k, cv::Point(20, output_image.rows - 60), FONT_FACE, FONT_SCALE,
+              WHITE, 2);
+  cv::putText(output_image, cv::format("temp = %6.2f 'C", read_temperature()),
+              cv::Point(output_image.cols - 200, output_image.rows - 60), FONT_FACE, FONT_SCALE, WHITE, 2);
+}
+
+// Annotated copy of a frame for display
+template <class Detector>
+static cv::Mat render_frame(const Detector &yolo, const detected_frame &df, const char *onnx_file,
+                            const std::string &label_htj2k) {
+  cv::Mat output_image;
+  if (df.format == pixel_format::i420) {
+    cv::cvtColor(df.frame, output_image, cv::COLOR_YUV2BGR_I420);
+  } else {
+    output_image = df.frame.clone();
+  }
+  yolo.draw(output_image, df.detections);
+  for (size_t i = 0; i < df.track_ids.size(); ++i) {
+    const cv::Rect &box = df.detections[i].box;
+    cv::putText(output_image, cv::format("#%u", df.track_ids[i]), cv::Point(box.x + 4, box.br().y - 8),
+                FONT_FACE, FONT_SCALE, WHITE, 2);
+  }
+  put_inference_info(output_image, onnx_file, df.t_infer);
+  put_status_info(output_image, label_htj2k);
+  return output_image;
+}
+
+static std::string htj2k_label(const encoded_frame &ef) {
+  return cv::format("HT Encoding takes %6.2f [ms], codestream size = %zu bytes", ef.t_encode,
+                    ef.codestream.size());
+}
+
+static void print_sender_stats(const sender_stats &s) {
+  printf("  %-8s depth %2zu  sent %10lu  dropped %6lu  resent %6lu  %s (%lu connections, %lu MB)\n", "tcp",
+         s.queued, static_cast<unsigned long>(s.sent), static_cast<unsigned long>(s.dropped),
+         static_cast<unsigned long>(s.resent), s.connected ? "connected" : "disconnected",
+         static_cast<unsigned long>(s.reconnects), static_cast<unsigned long>(s.bytes >> 20));
+}
+
+static void print_pool_stats(const encode_pool_stats &s) {
+  printf("  %-8s in flight %2zu  encoded %8lu  downgraded %6lu  skipped %6lu  failed %6lu\n", "encoders",
+         s.in_flight, static_cast<unsigned long>(s.encoded), static_cast<unsigned long>(s.downgraded),
+         static_cast<unsigned long>(s.skipped), static_cast<unsigned long>(s.failed));
+}
+
+static void print_gate_stats(const motion_gate_stats &s) {
+  printf("  %-8s frames %9lu  motion %8lu  keyframes %6lu  skipped %8lu  changed %5.1f%%\n", "gate",
+         static_cast<unsigned long>(s.frames), static_cast<unsigned long>(s.motion),
+         static_cast<unsigned long>(s.keyframes), static_cast<unsigned long>(s.skipped),
+         100.0f * s.changed);
+}
+
+#ifdef ENABLE_MULTITHREAD
+static void print_queue_stats(const char *name, const queue_stats &s) {
+  printf("  %-8s depth %2zu  pushed %8lu  dropped %6lu  producer stalls %6lu  consumer waits %6lu\n", name,
+         s.depth, static_cast<unsigned long>(s.pushed), static_cast<unsigned long>(s.dropped),
+         static_cast<unsigned long>(s.stalls), static_cast<unsigned long>(s.starved));
+}
+#endif
+
 /*************************************************************************************************/
 // MAIN
 /*************************************************************************************************/
 int main(int argc, char *argv[]) {
   // cv::setNumThreads(0);
 
-  if (argc != 4 && argc != 6) {
-    printf("usage: %s class_list modelfile(.onnx) <Qfactor> <capture-width capture-height> \n", argv[0]);
+  if (argc != 4 && argc != 6 && argc != 8) {
+    printf(
+        "usage: %s class_list modelfile(.onnx) <Qfactor> <capture-width capture-height> "
+        "<encode-width encode-height> \n",
+        argv[0]);
     return EXIT_FAILURE;
   }
   const char *fname_class_list = argv[1];
   const char *onnx_file        = argv[2];
 
-  bool INPUT_CAMERA = (argc == 6) ? true : false;
+  bool INPUT_CAMERA = (argc >= 6) ? true : false;
 
   const int Quality = std::stoi(argv[3]);
   int32_t tmpw = 640, tmph = 480;
@@ -55,138 +296,428 @@ int main(int argc, char *argv[]) {
   }
   const int32_t cap_width  = tmpw;
   const int32_t cap_height = tmph;
+  // Optionally, encode a full resolution stream while detecting on the capture size
+  const bool dual_stream   = (argc == 8);
+  const int32_t enc_width  = dual_stream ? std::stoi(argv[6]) : cap_width;
+  const int32_t enc_height = dual_stream ? std::stoi(argv[7]) : cap_height;
 
-  HTJ2KEncoder encoder;
-  enum progression { LRCP, RLCP, RPCL, PCRL, CPRL };
-  encoder.setQuality(false, 0.0f);
-  encoder.setDecompositions(5);
-  encoder.setBlockDimensions(Size(64, 64));
-  encoder.setProgressionOrder(RPCL);
-  encoder.setQfactor(Quality);
+  // Without a display nothing is rendered: no frame copies, no overlays, no HighGUI
+  const bool headless = (std::getenv("DISPLAY") == nullptr);
+  if (headless) {
+    printf("DISPLAY is not set, running headless (stop with Ctrl-C)\n");
+  }
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
 
-  const FrameInfo info = {static_cast<uint16_t>(cap_width), static_cast<uint16_t>(cap_height), 8, 3, false};
-  std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(info);
-  rawBytes.resize(0);
-  rawBytes.reserve(cap_width * cap_height * 3);
+  // CAPTURE_FORMAT=yuv420 keeps frames planar from the ISP to the encoder; detection converts on the fly
+  const char *capture_format = std::getenv("CAPTURE_FORMAT");
+  const bool yuv             = capture_format && std::string(capture_format) == "yuv420";
+  const pixel_format format  = yuv ? pixel_format::i420 : pixel_format::bgr;
+  const libcamera::PixelFormat cam_format = yuv ? libcamera::formats::YUV420 : libcamera::formats::RGB888;
+  // I420 frames are handled with chroma planes of exactly half the size in each direction
+  if (yuv && ((cap_width | cap_height | enc_width | enc_height) & 1)) {
+    printf("ERROR: YUV420 capture requires even frame sizes\n");
+    return EXIT_FAILURE;
+  }
+
+  // ROI_ENCODE=<factor> keeps detected objects intact and low-passes the background by that factor
+  const char *roi_env  = std::getenv("ROI_ENCODE");
+  const int32_t roi_bg = roi_env ? std::atoi(roi_env) : 0;
+  if (roi_bg > 1) {
+    printf("ROI encoding: background down-sampled by %d\n", roi_bg);
+  }
+
+  // MOTION_GATE=<keyframe interval> runs detection only on frames with motion, and at least every that
+  // many frames; the last detections are reused in between
+  const char *gate_env = std::getenv("MOTION_GATE");
+  std::unique_ptr<motion_gate> gate;
+  if (gate_env) {
+    gate.reset(new motion_gate(std::atoi(gate_env)));
+    printf("Motion gating: detection at least every %d frames\n", std::max(std::atoi(gate_env), 1));
+  }
+
+  // DETECT_INTERVAL=<n> runs detection on every n-th frame at most and tracks objects in between, so
+  // that boxes move on every frame; a person triggers encoding once, when its track is confirmed
+  const char *interval_env      = std::getenv("DETECT_INTERVAL");
+  const int32_t detect_interval = interval_env ? std::max(std::atoi(interval_env), 1) : 1;
+  std::unique_ptr<tracker> trk;
+  if (interval_env) {
+    // A track coasts through as many frames as it may miss detection rounds
+    trk.reset(new tracker(0.3f, 2, 3, 3 * detect_interval));
+    printf("Tracking: detection on every %d frames at most\n", detect_interval);
+  }
 
-  yolo_class yolo(MODEL_WIDTH, MODEL_HEIGHT, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+  // Whether a frame goes through detection; every frame counts toward the interval, and motion seen
+  // before it is up is kept until then
+  int32_t since_detect = detect_interval;
+  bool motion_pending  = false;
+  auto should_detect   = [&](const detected_frame &df) {
+    motion_pending = (!gate || gate->check(df.frame, df.format)) || motion_pending;
+    since_detect   = std::min(since_detect + 1, detect_interval);
+    if (!motion_pending || since_detect < detect_interval) {
+      return false;
+    }
+    motion_pending = false;
+    since_detect   = 0;
+    return true;
+  };
+
+  float model_width, model_height;
+  get_model_size(model_width, model_height);
+#ifndef ENABLE_MULTITHREAD
+  yolo_class yolo(model_width, model_height, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+#else
+  // Several instances overlap pre-processing of frame N+1 with inference of frame N
+  yolo_async yolo(NUM_INFERENCE_INSTANCES, async_mode::every_frame, model_width, model_height,
+                  SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+  // Frames are annotated by the display loop, only when they are shown
+  yolo.set_rendering(false);
+#endif
   // Create a YOLO instance
   try {
-    yolo.init(fname_class_list, onnx_file);
+    yolo.init(fname_class_list, onnx_file, get_engine_options());
   } catch (std::exception &exc) {
     return EXIT_FAILURE;
   }
 
-  assert(yolo.is_empty());
+  // DETECT_TILES=<cols>x<rows>[,<SAD threshold>] detects large frames (e.g. of the full sensor) as
+  // overlapping tiles of the model size, batched into one forward pass; with a threshold, tiles that
+  // did not change keep their detections
+  const char *tiles_env = std::getenv("DETECT_TILES");
+  int32_t tile_cols     = 0, tile_rows = 0;
+  float tile_sad        = 0.0f;
+  if (tiles_env && std::sscanf(tiles_env, "%dx%d,%f", &tile_cols, &tile_rows, &tile_sad) >= 2) {
+    yolo.set_tiling(tile_cols, tile_rows, 0.2f, tile_sad);
+    printf("Tiled detection: %d x %d tiles%s\n", tile_cols, tile_rows,
+           (tile_sad > 0.0f) ? ", unchanged tiles skipped" : "");
+  }
 
   // Load or capture an image
-  cv::Mat frame;
   LibCamera cam;
-  int ret = cam.initCamera(cap_width, cap_height, libcamera::formats::RGB888, 4, 0);
+  int ret;
+  if (dual_stream) {
+    // Encode stream as main, detection stream as lores; extra buffers cover frames in flight
+    ret = cam.initCamera(enc_width, enc_height, cam_format, 6, 0, cap_width, cap_height, cam_format);
+  } else {
+    ret = cam.initCamera(cap_width, cap_height, cam_format, 4, 0);
+  }
   if (ret) {
     printf("ERROR: Failed to initialize camera\n");
     return EXIT_FAILURE;
   }
-  libcamera::ControlList controls_;
-  int64_t frame_time = 1000000 / 30;
+  const libcamera::Size enc_size = cam.getSize(MAIN_STREAM);
+  const libcamera::Size cap_size = cam.getSize(LORES_STREAM);
+  if ((int32_t)enc_size.width != enc_width || (int32_t)enc_size.height != enc_height
+      || (int32_t)cap_size.width != cap_width || (int32_t)cap_size.height != cap_height) {
+    printf("ERROR: camera adjusted the stream size(s) to %u x %u / %u x %u\n", enc_size.width,
+           enc_size.height, cap_size.width, cap_size.height);
+    return EXIT_FAILURE;
+  }
   /**************************************************************************************/
   // Camera settings
   /**************************************************************************************/
-  // Set frame rate
-  controls_.set(libcamera::controls::FrameDurationLimits,
-                libcamera::Span<const int64_t, 2>({frame_time, frame_time}));
-  // Adjust the brightness of the output images, in the range -1.0 to 1.0
-  controls_.set(libcamera::controls::Brightness, 0.0);
-  // Adjust the contrast of the output image, where 1.0 = normal contrast
-  controls_.set(libcamera::controls::Contrast, 1.0);
-  // Set the exposure time
-  //  controls_.set(libcamera::controls::ExposureTime, 20000);
-  // Set Auto exposure
-  controls_.set(libcamera::controls::AeEnable, libcamera::controls::AE_ENABLE);
-  // Focus related settings
-  //   Set autofocus mode
-  controls_.set(libcamera::controls::AfMode, libcamera::controls::AfModeAuto);
-  controls_.set(libcamera::controls::AfMetering, libcamera::controls::AfMeteringAuto);
-  controls_.set(libcamera::controls::AfRange, libcamera::controls::AfRangeNormal);
-  controls_.set(libcamera::controls::AfSpeed, libcamera::controls::AfSpeedNormal);
-  //   Set manual focus mode
-  // controls_.set(libcamera::controls::AfMode, libcamera::controls::AfModeManual);
-  // controls_.set(libcamera::controls::LensPosition, 0.5);
-  cam.set(controls_);  // Write camera settings
-
-  LibcameraOutData frameData;
-  cam.startCamera();
+  setup_camera(cam);
 
-  cv::Mat output_image;
+  // Codestreams are sent over one long-lived connection by a thread of its own
+  std::string sink_address;
+  int32_t sink_port;
+  get_sink(sink_address, sink_port);
+  std::unique_ptr<tcp_sender> sender;
+  try {
+    sender.reset(new tcp_sender(sink_address, sink_port));
+  } catch (std::exception &exc) {
+    return EXIT_FAILURE;
+  }
 
-  while (true) {  // loop begin
-    bool flag = cam.readFrame(&frameData);
-    if (!flag) continue;
-    frame = cv::Mat(cap_height, cap_width, CV_8UC3, frameData.imageData);
+  // CROP_ENCODE=<padding> encodes each detected object, grown by that many pixels, as a codestream of
+  // its own instead of the whole frame
+  const char *crop_env = std::getenv("CROP_ENCODE");
+  std::unique_ptr<crop_encoder> crops;
+  if (crop_env) {
+    const int32_t padding = std::max(std::atoi(crop_env), 0);
+    const int32_t workers = std::clamp(static_cast<int32_t>(std::thread::hardware_concurrency()), 1, 4);
+    crops.reset(new crop_encoder(workers, padding, Quality));
+    printf("Crop encoding: padding %d px, %zu workers\n", padding, crops->num_workers());
+  }
 
-    __attribute__((unused)) int tr0 = yolo.get_aftrigger();
+  // Whole frames are encoded by a pool of workers, so that a burst of triggers is encoded in parallel.
+  // While all workers are busy, frames are encoded at a lower Qfactor; beyond two frames per worker
+  // in flight they are skipped.
+  const char *workers_env      = std::getenv("ENCODE_WORKERS");
+  const int32_t encode_workers = std::max(workers_env ? std::atoi(workers_env) : NUM_ENCODE_WORKERS, 1);
+  const size_t n_workers       = static_cast<size_t>(encode_workers);
+  const encode_policy policy   = {Quality, std::max(Quality - DOWNGRADE_QFACTOR_STEP, 1), n_workers,
+                                  2 * n_workers};
+  encoder_pool pool(encode_workers, policy, roi_bg);
+  std::deque<std::pair<detected_frame, std::future<encode_result>>> encoding;
 
-    // Object detection by YOLOv5
-    output_image = yolo.invoke(frame);
+  // Send the frames whose encoding is done, in capture order; with `wait`, all of them.
+  // Returns the label of the last frame sent, empty if none.
+  auto send_encoded = [&](bool wait) {
+    std::string label;
+    while (!encoding.empty()) {
+      auto &front = encoding.front();
+      if (!wait && front.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        break;
+      }
+      encode_result r = front.second.get();
+      if (!r.codestream.empty()) {
+        encoded_frame ef;
+        ef.codestream = std::move(r.codestream);
+        ef.t_encode   = r.t_encode;
+        describe_frame(front.first, r.qfactor, ef);
+        label = htj2k_label(ef);
+        if (r.outcome == encode_outcome::downgraded) {
+          label += cv::format(" (Qfactor %d)", r.qfactor);
+        }
+        send_codestream(*sender, ef);
+      }
+      encoding.pop_front();
+    }
+    return label;
+  };
+
+  // Hand a triggered frame, which owns its image, to the encoders and send what is done; returns the
+  // label shown on the display
+  auto encode_and_send = [&](detected_frame &&job) {
+    if (crops && !job.detections.empty()) {
+      send_encoded(true);  // crops follow the frames triggered before them
+      encoded_frame ef;
+      size_t bytes = 0, sent = 0;
+      for (auto &c : crops->encode(job.frame, job.format, job.detections)) {
+        if (c.codestream.empty()) {
+          continue;
+        }
+        bytes += c.codestream.size();
+        describe_crop(job, Quality, c, ef);
+        ef.codestream = std::move(c.codestream);
+        send_codestream(*sender, ef);
+        sent++;
+      }
+      return cv::format("HT Encoding of %zu crops takes %6.2f [ms], codestream size = %zu bytes", sent,
+                        crops->get_encode_time(), bytes);
+    }
+    std::future<encode_result> f = pool.submit(job.frame, job.format, job.detections);
+    encoding.emplace_back(std::move(job), std::move(f));
+    return send_encoded(false);
+  };
 
-    int tr1 = yolo.get_aftrigger();
+  cam.startCamera();
 
-    // Put efficiency information
-    double t               = yolo.get_inference_time();
-    std::string label_yolo = cv::format("Model: %s , Inference time: %6.2f ms", onnx_file, t);
-    cv::putText(output_image, label_yolo, cv::Point(20, 40), FONT_FACE, FONT_SCALE, WHITE, 2);
+#ifndef ENABLE_MULTITHREAD
+  assert(yolo.is_empty());
 
-    int32_t keycode = cv::pollKey();
+  /**************************************************************************************/
+  // Single thread: capture -> detection -> encoding -> send -> display
+  /**************************************************************************************/
+  detected_frame df;
+  df.seq = 0;
+  while (g_running.load()) {  // loop begin
+    // Sleeps until a frame is ready; the buffer is requeued when `frame` goes out of scope
+    LibcameraFrame frame;
+    if (!cam.readFrame(frame)) continue;
+    df.timestamp_us = now_us();
+    df.frame        = stream_image(cam, frame, LORES_STREAM, format);
+    df.format       = format;
+
+    // Without detection the tracks are predicted, or else the detections of the previous frame stay
+    const bool detected = should_detect(df);
+    if (detected) {
+      detect_frame(yolo, df);
+    } else {
+      df.t_infer = 0.0;
+    }
+    if (trk) {
+      if (detected) {
+        trk->update(df.detections, image_size(df.frame, df.format));
+      } else {
+        trk->predict(image_size(df.frame, df.format));
+      }
+      apply_tracks(*trk, df);
+    }
+
+    int32_t keycode = headless ? -1 : cv::pollKey();
 
     if (keycode == 'q') {
       break;
     }
 
-    /*************************************************************************************************/
-    // HTJ2K encoding
-    /*************************************************************************************************/
-    std::string label_htj2k = cv::format("");
-    if (tr1 || keycode == 'c') {
-      cv::Mat RGBimg;
-      std::string fname = create_filename_based_on_time();
-      cv::cvtColor(frame, RGBimg, cv::COLOR_BGR2RGB);
-      encoder.setSourceImage(RGBimg.data, RGBimg.cols * RGBimg.rows * 3);
-      auto t_j2k_0 = std::chrono::high_resolution_clock::now();
-      encoder.encode();
-      auto t_j2k     = std::chrono::high_resolution_clock::now() - t_j2k_0;
-      auto duration  = std::chrono::duration_cast<std::chrono::microseconds>(t_j2k).count();
-      std::vector cb = encoder.getEncodedBytes();
-      label_htj2k    = cv::format("HT Encoding takes %6.2f [ms], codestream size = %zu bytes",
-                                  static_cast<double>(duration) / 1000.0, cb.size());
-      cv::putText(output_image, label_htj2k, cv::Point(20, cap_height - 60), FONT_FACE, FONT_SCALE, WHITE,
-                  2);
-      // send codestream via TCP connection
-      simple_tcp tcp_socket("133.36.41.118", 4001);
-      if (!tcp_socket.create_client()) {
-        tcp_socket.Tx(cb.data(), cb.size());
-      }
+    // The encoders keep the image beyond this iteration, when the camera buffer is requeued
+    std::string label_htj2k;
+    if (df.trigger || keycode == 'c') {
+      const cv::Mat image = stream_image(cam, frame, MAIN_STREAM, format).clone();
+      label_htj2k         = encode_and_send(make_encode_job(df, image));
+    } else {
+      label_htj2k = send_encoded(false);
     }
 
-    /*************************************************************************************************/
-    // Get temperature
-    /*************************************************************************************************/
-    FILE *fp;
-    char temp_read[16] = "";
-    float pi_temp;
-    fp = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-    fgets(temp_read, 16, fp);
-    fclose(fp);
-    pi_temp = std::stoi(temp_read, nullptr, 10) / 1000.0f;
-    cv::putText(output_image, cv::format("temp = %6.2f 'C", pi_temp),
-                cv::Point(cap_width - 200, cap_height - 60), FONT_FACE, FONT_SCALE, WHITE, 2);
-
     // Show image
-    cv::imshow("Output", output_image);
+    if (!headless) {
+      cv::imshow("Output", render_frame(yolo, df, onnx_file, label_htj2k));
+    }
 
-    cam.returnFrameBuffer(frameData);
+    df.seq++;
   }  // loop end
+  send_encoded(true);
+#else
+  /**************************************************************************************/
+  // Multi thread: each stage runs on its own worker, linked by bounded SPSC rings.
+  // Rings drop the oldest element when full, so a slow encoder or an unreachable
+  // receiver never stalls detection or the camera.
+  /**************************************************************************************/
+  spsc_queue<detected_frame> q_capture(2, queue_policy::drop_oldest);
+  spsc_queue<detected_frame> q_display(2, queue_policy::drop_oldest);
+  spsc_queue<detected_frame> q_encode(4, queue_policy::drop_oldest);
+  std::atomic<bool> running(true);
+  std::atomic<bool> force_capture(false);
+  std::mutex label_mutex;
+  std::string label_htj2k;
+
+  // Capture: copy the detection image out of the camera buffer. A separate encode stream stays in
+  // its buffer until detection decides whether it is encoded; otherwise the buffer is requeued now.
+  std::thread th_capture([&] {
+    uint64_t seq = 0;
+    LibcameraFrame frame;
+    while (running.load()) {
+      if (!cam.readFrame(frame)) {
+        continue;
+      }
+      detected_frame df;
+      df.seq          = seq++;
+      df.timestamp_us = now_us();
+      df.frame        = stream_image(cam, frame, LORES_STREAM, format).clone();
+      df.format       = format;
+      if (dual_stream) {
+        df.capture = std::make_shared<LibcameraFrame>(std::move(frame));
+      } else {
+        frame.release();
+      }
+      q_capture.push(std::move(df));
+    }
+    q_capture.close();
+  });
+
+  // Detection: frames are submitted to the inference pool and completed in capture order
+  std::thread th_detect([&] {
+    // Frames skipped by the motion gate or the interval have no future; their tracks are predicted,
+    // or they take the detections of the frame before
+    std::deque<std::pair<detected_frame, std::future<yolo_result>>> inflight;
+    yolo_result last;
+    last.trigger = 0;
+    last.t_infer = 0.0;
+    auto complete_front = [&] {
+      detected_frame df   = std::move(inflight.front().first);
+      const bool detected = inflight.front().second.valid();
+      if (detected) {
+        last = inflight.front().second.get();
+      } else {
+        last.t_infer = 0.0;
+      }
+      inflight.pop_front();
+      df.detections = last.detections;
+      df.trigger    = last.trigger;
+      df.t_infer    = last.t_infer;
+      if (trk) {
+        if (detected) {
+          trk->update(df.detections, image_size(df.frame, df.format));
+        } else {
+          trk->predict(image_size(df.frame, df.format));
+        }
+        apply_tracks(*trk, df);
+      }
+      if (df.trigger || force_capture.exchange(false)) {
+        q_encode.push(make_encode_job(
+            df, df.capture ? stream_image(cam, *df.capture, MAIN_STREAM, format).clone() : df.frame));
+      }
+      df.capture.reset();  // requeue the camera buffers
+      q_display.push(std::move(df));
+    };
+    detected_frame df;
+    while (!q_capture.is_closed() || !q_capture.empty()) {
+      if (q_capture.pop(df, std::chrono::milliseconds(5))) {
+        std::future<yolo_result> f;
+        if (should_detect(df)) {
+          f = yolo.submit(df.frame, df.format);
+        }
+        inflight.emplace_back(std::move(df), std::move(f));
+      }
+      // Complete in order; wait only when every instance has a frame in flight
+      while (!inflight.empty()) {
+        const std::future<yolo_result> &front = inflight.front().second;
+        const bool ready =
+            !front.valid() || front.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        if (!ready && inflight.size() <= yolo.num_instances()) {
+          break;
+        }
+        complete_front();
+      }
+    }
+    while (!inflight.empty()) {
+      complete_front();
+    }
+    q_encode.close();
+    q_display.close();
+  });
+
+  // HTJ2K encoding: frames are handed to the encoder pool, codestreams are sent in capture order
+  std::thread th_encode([&] {
+    detected_frame job;
+    while (!q_encode.is_closed() || !q_encode.empty()) {
+      const auto timeout = std::chrono::milliseconds(encoding.empty() ? 100 : 5);
+      const std::string label =
+          q_encode.pop(job, timeout) ? encode_and_send(std::move(job)) : send_encoded(false);
+      if (!label.empty()) {
+        std::lock_guard<std::mutex> lock(label_mutex);
+        label_htj2k = label;
+      }
+    }
+    send_encoded(true);
+  });
+
+  // Display (HighGUI has to stay on the main thread)
+  auto t_report = std::chrono::steady_clock::now();
+  detected_frame df;
+  while (g_running.load()) {
+    if (q_display.pop(df) && !headless) {
+      std::string label;
+      {
+        std::lock_guard<std::mutex> lock(label_mutex);
+        label = label_htj2k;
+      }
+      cv::imshow("Output", render_frame(yolo, df, onnx_file, label));
+    }
+    int32_t keycode = headless ? -1 : cv::pollKey();
+    if (keycode == 'q') {
+      break;
+    }
+    if (keycode == 'c') {
+      force_capture.store(true);
+    }
+    if (std::chrono::steady_clock::now() - t_report > std::chrono::seconds(5)) {
+      t_report = std::chrono::steady_clock::now();
+      printf("Pipeline queues:\n");
+      print_queue_stats("capture", q_capture.get_stats());
+      print_queue_stats("display", q_display.get_stats());
+      print_queue_stats("encode", q_encode.get_stats());
+      print_sender_stats(sender->get_stats());
+      print_pool_stats(pool.get_stats());
+      if (gate) {
+        print_gate_stats(gate->get_stats());
+      }
+    }
+  }
+
+  running.store(false);
+  th_capture.join();
+  th_detect.join();
+  th_encode.join();
+#endif
+  print_pool_stats(pool.get_stats());
+  if (gate) {
+    print_gate_stats(gate->get_stats());
+  }
+  sender->stop();
 
-  cam.returnFrameBuffer(frameData);
   cam.stopCamera();
   cam.closeCamera();
 
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "LibCamera.h"
+#include "batch_scheduler.hpp"
+#include "encoder_pool.hpp"
+#include "tcp_sender.hpp"
+#include "wire_protocol.hpp"
+#include "yolo.hpp"
+
+#include "capture_config.hpp"
+#include "model_config.hpp"
+
+/**************************************************************************************************
+  Several cameras served by one detector
+
+  Each camera is captured by a thread of its own. Frames of all cameras are gathered into dynamic
+  batches (at most one frame per camera, closed when every camera has delivered or after a deadline)
+  and detected by a single network as one N-batch blob, instead of one process and one network per
+  camera. Frames with a person are encoded by a shared pool of HTJ2K encoders and sent over one
+  connection, tagged with the index of their camera.
+
+  usage: yolo_multi class_list modelfile(.onnx) <Qfactor> <width height> [number of cameras]
+
+  BATCH_WAIT_MS (default 10) is the deadline of a batch after its first frame; HTJ2K_SINK,
+  ENCODE_WORKERS and the YOLO_* variables are those of yolo. Stop with Ctrl-C.
+**************************************************************************************************/
+
+/* ========================================================================= */
+/*                         Set up messaging services                         */
+/* ========================================================================= */
+
+class kdu_stream_message : public kdu_core::kdu_thread_safe_message {
+ public:
+  kdu_stream_message(std::ostream *stream) { this->stream = stream; }
+  void put_text(const char *string) { (*stream) << string; }
+  void flush(bool end_of_message = false) {
+    stream->flush();
+    kdu_thread_safe_message::flush(end_of_message);
+  }
+
+ private:
+  std::ostream *stream;
+};
+
+static kdu_stream_message cerr_message(&std::cerr);
+static kdu_core::kdu_message_formatter pretty_cerr(&cerr_message);
+
+static std::atomic<bool> g_running(true);
+
+static void on_signal(int) { g_running = false; }
+
+// Frame of one camera, copied out of its buffer
+struct source_frame {
+  uint64_t seq;
+  uint64_t timestamp_us;  // capture time [us since the Unix epoch]
+  cv::Mat frame;          // BGR
+};
+
+// Header of an encoded frame of a camera
+static wire_frame_info describe_frame(size_t camera, const source_frame &sf,
+                                      const std::vector<detection> &dets) {
+  wire_frame_info info;
+  info.seq             = sf.seq;
+  info.timestamp_us    = sf.timestamp_us;
+  info.camera_id       = static_cast<uint16_t>(camera);
+  info.width           = static_cast<uint16_t>(sf.frame.cols);
+  info.height          = static_cast<uint16_t>(sf.frame.rows);
+  info.components      = 3;
+  info.format          = wire_pixel_format::rgb;
+  info.levels          = 5;
+  info.block_size_log2 = 6;  // 64 x 64
+  for (const auto &d : dets) {
+    info.detections.push_back({static_cast<uint16_t>(d.class_id), d.score, d.box.x, d.box.y, d.box.width,
+                               d.box.height});
+  }
+  return info;
+}
+
+static void print_batch_stats(const batch_stats &s, double t_frame) {
+  printf("batches %8lu  frames/batch %4.2f  closed by deadline %6lu  replaced %6lu  "
+         "inference %6.2f ms/frame\n",
+         static_cast<unsigned long>(s.batches), s.batches ? static_cast<double>(s.items) / s.batches : 0.0,
+         static_cast<unsigned long>(s.deadlines), static_cast<unsigned long>(s.replaced), t_frame);
+}
+
+static bool has_person(const std::vector<detection> &dets) {
+  return std::any_of(dets.begin(), dets.end(), [](const detection &d) { return d.class_id == 0; });
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 6 && argc != 7) {
+    printf("usage: %s class_list modelfile(.onnx) <Qfactor> <width height> [number of cameras]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *fname_class_list = argv[1];
+  const char *onnx_file        = argv[2];
+  const int32_t Quality        = std::stoi(argv[3]);
+  const int32_t width          = std::stoi(argv[4]);
+  const int32_t height         = std::stoi(argv[5]);
+  // The camera manager started to count the cameras is kept for initCamera()
+  std::vector<std::unique_ptr<LibCamera>> cams;
+  cams.emplace_back(new LibCamera(0));
+  const int32_t num_cameras = (argc == 7) ? std::stoi(argv[6]) : cams[0]->getNumCameras();
+  if (num_cameras < 1) {
+    printf("ERROR: no camera found\n");
+    return EXIT_FAILURE;
+  }
+  const char *wait_env  = std::getenv("BATCH_WAIT_MS");
+  const int32_t wait_ms = std::max(wait_env ? std::atoi(wait_env) : 10, 0);
+  kdu_core::kdu_customize_errors(&pretty_cerr);
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+
+  // One network for all cameras, taking a frame of each per forward pass
+  float model_width, model_height;
+  get_model_size(model_width, model_height);
+  yolo_class yolo(model_width, model_height, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+  try {
+    yolo.init(fname_class_list, onnx_file, get_engine_options());
+    yolo.set_batch_size(num_cameras);
+  } catch (std::exception &exc) {
+    return EXIT_FAILURE;
+  }
+
+  for (int32_t i = 0; i < num_cameras; ++i) {
+    if (i > 0) {
+      cams.emplace_back(new LibCamera(i));
+    }
+    LibCamera &cam = *cams[i];
+    if (cam.initCamera(width, height, libcamera::formats::RGB888, 4, 0)) {
+      printf("ERROR: Failed to initialize camera %d\n", i);
+      return EXIT_FAILURE;
+    }
+    const libcamera::Size size = cam.getSize(MAIN_STREAM);
+    if ((int32_t)size.width != width || (int32_t)size.height != height) {
+      printf("ERROR: camera %d adjusted the stream size to %u x %u\n", i, size.width, size.height);
+      return EXIT_FAILURE;
+    }
+    setup_camera(cam);
+  }
+
+  std::string sink_address;
+  int32_t sink_port;
+  get_sink(sink_address, sink_port);
+  std::unique_ptr<tcp_sender> sender;
+  try {
+    sender.reset(new tcp_sender(sink_address, sink_port));
+  } catch (std::exception &exc) {
+    return EXIT_FAILURE;
+  }
+  const char *workers_env      = std::getenv("ENCODE_WORKERS");
+  const int32_t encode_workers = std::max(workers_env ? std::atoi(workers_env) : NUM_ENCODE_WORKERS, 1);
+  const size_t n_workers       = static_cast<size_t>(encode_workers);
+  const encode_policy policy   = {Quality, std::max(Quality - DOWNGRADE_QFACTOR_STEP, 1), n_workers,
+                                  2 * n_workers};
+  encoder_pool pool(encode_workers, policy);
+  std::deque<std::pair<wire_frame_info, std::future<encode_result>>> encoding;
+
+  // Send the frames whose encoding is done, in submission order; with `wait`, all of them
+  auto send_encoded = [&](bool wait) {
+    while (!encoding.empty()) {
+      auto &front = encoding.front();
+      if (!wait && front.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        break;
+      }
+      encode_result r = front.second.get();
+      if (!r.codestream.empty()) {
+        front.first.qfactor = static_cast<uint8_t>(r.qfactor);
+        std::vector<uint8_t> header;
+        wire_encode_header(front.first, static_cast<uint32_t>(r.codestream.size()), header);
+        sender->send(std::move(header), std::move(r.codestream));
+      }
+      encoding.pop_front();
+    }
+  };
+
+  // Capture: one thread per camera; the last one to stop closes the scheduler
+  batch_scheduler<source_frame> scheduler(num_cameras, std::chrono::milliseconds(wait_ms));
+  std::atomic<int32_t> capturing(num_cameras);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < num_cameras; ++i) {
+    cams[i]->startCamera();
+    threads.emplace_back([&, i] {
+      LibCamera &cam      = *cams[i];
+      const size_t stride = cam.getStride(MAIN_STREAM);
+      uint64_t seq        = 0;
+      LibcameraFrame frame;
+      while (g_running.load()) {
+        if (!cam.readFrame(frame)) {
+          continue;
+        }
+        source_frame sf;
+        sf.seq          = seq++;
+        sf.timestamp_us = now_us();
+        sf.frame        = cv::Mat(height, width, CV_8UC3, frame.data(MAIN_STREAM), stride).clone();
+        frame.release();
+        scheduler.submit(i, std::move(sf));
+      }
+      if (--capturing == 0) {
+        scheduler.close();
+      }
+    });
+  }
+  printf("%d cameras, batches closed after %d ms\n", num_cameras, wait_ms);
+
+  // Detection of the batches, encoding and sending of the frames with a person
+  std::vector<std::pair<size_t, source_frame>> batch;
+  std::vector<cv::Mat> frames;
+  std::vector<pixel_format> formats;
+  uint64_t n_detected = 0;
+  double t_infer      = 0.0;
+  auto t_report       = std::chrono::steady_clock::now();
+  while (scheduler.next_batch(batch)) {
+    frames.clear();
+    for (const auto &b : batch) {
+      frames.push_back(b.second.frame);
+    }
+    formats.assign(frames.size(), pixel_format::bgr);
+    const std::vector<std::vector<detection>> &results = yolo.detect_batch(frames, formats);
+    n_detected += batch.size();
+    t_infer += yolo.get_inference_time();
+    for (size_t k = 0; k < batch.size(); ++k) {
+      if (has_person(results[k])) {
+        const source_frame &sf = batch[k].second;
+        encoding.emplace_back(describe_frame(batch[k].first, sf, results[k]),
+                              pool.submit(sf.frame, pixel_format::bgr, results[k]));
+      }
+    }
+    send_encoded(false);
+
+    if (std::chrono::steady_clock::now() - t_report > std::chrono::seconds(5)) {
+      t_report            = std::chrono::steady_clock::now();
+      print_batch_stats(scheduler.get_stats(), n_detected ? t_infer / n_detected : 0.0);
+    }
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  send_encoded(true);
+  print_batch_stats(scheduler.get_stats(), n_detected ? t_infer / n_detected : 0.0);
+  sender->stop();
+
+  for (auto &cam : cams) {
+    cam->stopCamera();
+    cam->closeCamera();
+  }
+  return EXIT_SUCCESS;
+}
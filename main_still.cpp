@@ -16,10 +16,12 @@ int main(int argc, char *argv[]) {
   const char *fname_class_list = argv[1];
   const char *onnx_file        = argv[2];
 
-  yolo_class yolo(MODEL_WIDTH, MODEL_HEIGHT, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+  float model_width, model_height;
+  get_model_size(model_width, model_height);
+  yolo_class yolo(model_width, model_height, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
   // Create a YOLO instance
   try {
-    yolo.init(fname_class_list, onnx_file);
+    yolo.init(fname_class_list, onnx_file, get_engine_options());
   } catch (std::exception &exc) {
     return EXIT_FAILURE;
   }
@@ -7,7 +7,8 @@
 #include <cstring>
 #include <ctime>
 #include <vector>
-#include <HTJ2KEncoder.hpp>
+#include "crop_encoder.hpp"
+#include "htj2k_encoder.hpp"
 #include "yolo.hpp"
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
@@ -61,10 +62,12 @@ int main(int argc, char *argv[]) {
   const int Quality = 85;
 
 
-  yolo_class yolo(MODEL_WIDTH, MODEL_HEIGHT, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
+  float model_width, model_height;
+  get_model_size(model_width, model_height);
+  yolo_class yolo(model_width, model_height, SCORE_THRESHOLD, NMS_THRESHOLD, CONFIDENCE_THRESHOLD);
   // Create a YOLO instance
   try {
-    yolo.init(fname_class_list, onnx_file);
+    yolo.init(fname_class_list, onnx_file, get_engine_options());
   } catch (std::exception &exc) {
     return EXIT_FAILURE;
   }
@@ -83,20 +86,18 @@ int main(int argc, char *argv[]) {
   camera.set(cv::CAP_PROP_FRAME_HEIGHT, cap_height);
   cv::Mat output_image;
 
-  HTJ2KEncoder encoder;
-  enum progression {
-    LRCP, RLCP, RPCL, PCRL, CPRL
-  };
-  encoder.setQuality(false, 0.0f);
-  encoder.setDecompositions(5);
-  encoder.setBlockDimensions(Size(64, 64));
-  encoder.setProgressionOrder(RPCL);
-  encoder.setQfactor(Quality);
-  
-  const FrameInfo info = {static_cast<uint16_t>(cap_width), static_cast<uint16_t>(cap_height), 8, 3, false};
-  std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(info);
-  rawBytes.resize(0);
-  rawBytes.reserve(cap_width * cap_height * 3);
+  htj2k_encoder encoder;
+  encoder.set_decompositions(5);
+  encoder.set_block_size(64);
+  encoder.set_progression_order("RPCL");
+
+  // CROP_ENCODE=<padding> saves each detected object, grown by that many pixels, as a file of its own
+  const char *crop_env = std::getenv("CROP_ENCODE");
+  std::unique_ptr<crop_encoder> crops;
+  if (crop_env) {
+    const int32_t workers = std::clamp(static_cast<int32_t>(std::thread::hardware_concurrency()), 1, 4);
+    crops.reset(new crop_encoder(workers, std::max(std::atoi(crop_env), 0), Quality));
+  }
 
   while (true) {
     if (camera.read(frame) == false) {
@@ -106,7 +107,9 @@ int main(int argc, char *argv[]) {
     __attribute__((unused)) int tr0 = yolo.get_aftrigger();
 
     // Process the image
-    output_image = yolo.invoke(frame);
+    const std::vector<detection> &dets = yolo.detect(frame);
+    output_image                       = frame.clone();
+    yolo.draw(output_image, dets);
 
     int tr1 = yolo.get_aftrigger();
 
@@ -116,20 +119,46 @@ int main(int argc, char *argv[]) {
     cv::putText(output_image, label, cv::Point(20, 40), FONT_FACE, FONT_SCALE, RED, 2);
     imshow("Output", output_image);
 
+    // compress each detected object into HTJ2K and save it as <time>_<class>_<score>_<index>.j2c
+    if (tr1 && crops) {
+      const std::string stem        = create_filename_based_on_time();
+      std::vector<encoded_crop> &cs = crops->encode(frame, pixel_format::bgr, dets);
+      size_t bytes = 0, written = 0;
+      for (size_t i = 0; i < cs.size(); ++i) {
+        if (cs[i].codestream.empty()) {
+          continue;
+        }
+        const std::string fname =
+            cv::format("%s_%s_%.2f_%zu.j2c", stem.substr(0, stem.size() - 4).c_str(),
+                       yolo.get_class_list()[cs[i].class_id].c_str(), cs[i].score, i);
+        FILE *fp = fopen(fname.c_str(), "wb");
+        if (fp == nullptr) {
+          printf("ERROR: cannot open %s\n", fname.c_str());
+          continue;
+        }
+        fwrite(cs[i].codestream.data(), sizeof(uint8_t), cs[i].codestream.size(), fp);
+        fclose(fp);
+        bytes += cs[i].codestream.size();
+        written++;
+      }
+      printf("HT Encoding of %zu crops takes %f [ms], codestream size = %zu bytes\n", written,
+             crops->get_encode_time(), bytes);
+    }
+
     // compress a frame into HTJ2K and save it as a file
-    if (tr1) {
+    if (tr1 && !crops) {
       std::string fname = create_filename_based_on_time();
-      cv::cvtColor(frame, output_image, cv::COLOR_BGR2RGB);
-      auto t_j2k_0 = std::chrono::high_resolution_clock::now();
-      encoder.setSourceImage(output_image.data, output_image.cols * output_image.rows * 3);
-      encoder.encode();
-      auto t_j2k    = std::chrono::high_resolution_clock::now() - t_j2k_0;
-      auto duration = std::chrono::duration_cast<std::chrono::microseconds>(t_j2k).count();
-      std::vector cb = encoder.getEncodedBytes();
+      // BGR samples are read in place; the codestream stays in the encoder's buffer
+      const image_view src = {frame.data, frame.cols, frame.rows, static_cast<int32_t>(frame.step[0]),
+                              3, true};
+      auto t_j2k_0         = std::chrono::high_resolution_clock::now();
+      const codestream_span cb = encoder.encode(src, Quality);
+      auto t_j2k               = std::chrono::high_resolution_clock::now() - t_j2k_0;
+      auto duration            = std::chrono::duration_cast<std::chrono::microseconds>(t_j2k).count();
       printf("HT Encoding takes %f [ms], codestream size = %zu bytes\n",
-             static_cast<double>(duration) / 1000.0, cb.size());
+             static_cast<double>(duration) / 1000.0, cb.size);
       FILE *fp = fopen(fname.c_str(), "wb");
-      fwrite(cb.data(), sizeof(uint8_t), cb.size(), fp);
+      fwrite(cb.data, sizeof(uint8_t), cb.size, fp);
       fclose(fp);
     }
 
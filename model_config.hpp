@@ -1,8 +1,13 @@
 #pragma once
 
-// Define the size of model
-// 1. width and height shall be equal to each ohter
-// 2. shall be equal to 160 or 320 or 640
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include "inference_engine.hpp"
+
+// Define the default size of model
+// 1. width and height shall be multiples of 32 (non-square sizes such as 256x192 are allowed)
+// 2. can be overridden at run time by the environment variable YOLO_MODEL_SIZE=<width>x<height>
 // Corresponding .onnx is required!
 constexpr float MODEL_WIDTH  = 160.0f;
 constexpr float MODEL_HEIGHT = 160.0f;
@@ -11,3 +16,43 @@ constexpr float MODEL_HEIGHT = 160.0f;
 constexpr float SCORE_THRESHOLD      = 0.5f;
 constexpr float NMS_THRESHOLD        = 0.45f;
 constexpr float CONFIDENCE_THRESHOLD = 0.45f;
+
+// Number of network instances running concurrently in the multi-threaded pipeline
+constexpr int32_t NUM_INFERENCE_INSTANCES = 2;
+
+// Number of HTJ2K encoder workers for triggered frames (overridden by ENCODE_WORKERS=<n>), and the
+// Qfactor reduction applied to frames encoded while all workers are busy
+constexpr int32_t NUM_ENCODE_WORKERS     = 2;
+constexpr int32_t DOWNGRADE_QFACTOR_STEP = 20;
+
+// Get the size of model, taking YOLO_MODEL_SIZE into account
+inline void get_model_size(float &width, float &height) {
+  width             = MODEL_WIDTH;
+  height            = MODEL_HEIGHT;
+  const char *value = std::getenv("YOLO_MODEL_SIZE");
+  int w, h;
+  if (value != nullptr && std::sscanf(value, "%dx%d", &w, &h) == 2) {
+    width  = static_cast<float>(w);
+    height = static_cast<float>(h);
+  }
+}
+
+// Get options of the inference engine from the environment variables
+//   YOLO_BACKEND=opencv|onnxruntime, YOLO_PRECISION=fp32|fp16|int8,
+//   YOLO_THREADS=<intra-op threads>, YOLO_GRAPH_OPT=0..3
+inline engine_options get_engine_options() {
+  engine_options opt;
+  if (const char *value = std::getenv("YOLO_BACKEND")) {
+    opt.backend = value;
+  }
+  if (const char *value = std::getenv("YOLO_PRECISION")) {
+    opt.precision = value;
+  }
+  if (const char *value = std::getenv("YOLO_THREADS")) {
+    opt.intra_op_threads = std::atoi(value);
+  }
+  if (const char *value = std::getenv("YOLO_GRAPH_OPT")) {
+    opt.graph_opt_level = std::atoi(value);
+  }
+  return opt;
+}
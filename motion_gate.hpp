@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "yolo.hpp"
+
+// Snapshot of gate counters
+struct motion_gate_stats {
+  uint64_t frames;     // frames checked
+  uint64_t motion;     // frames passed because of motion
+  uint64_t keyframes;  // frames passed because the keyframe interval elapsed
+  uint64_t skipped;    // frames whose detections were reused
+  float changed;       // fraction of blocks changed in the last frame
+};
+
+/**************************************************************************************************
+  Motion gating of object detection
+
+  A cheap test in front of the network: luma is down-sampled by 4 (INTER_AREA, i.e. 4x4 means),
+  compared with a running background (exponential moving average of the same), and the absolute
+  differences are averaged over blocks of 4x4, which gives the mean SAD of 16x16 pixel blocks of
+  the frame. Detection runs when the share of blocks above the SAD threshold reaches the area
+  threshold, or when `keyframe_interval` frames went by without detection (to catch objects that
+  entered slowly); in between the caller reuses the last detections. Every step runs on OpenCV
+  primitives, which are vectorized (NEON/SSE) and work on 1/16 of the pixels after the first
+  resize. I420 frames use their Y plane; BGR frames are reduced before the conversion to gray.
+**************************************************************************************************/
+class motion_gate {
+ private:
+  static constexpr int32_t SCALE = 4;  // luma down-sampling
+  static constexpr int32_t BLOCK = 4;  // blocks of the motion map, in down-sampled pixels
+
+  int32_t keyframe_interval;
+  float sad_threshold;   // mean absolute difference of a block [luma levels]
+  float area_threshold;  // share of changed blocks
+  double alpha;          // background update rate
+  cv::Mat small;
+  cv::Mat luma;
+  cv::Mat background;  // CV_32F
+  cv::Mat background_u8;
+  cv::Mat diff;
+  cv::Mat blocks;  // mean SAD per block
+  cv::Mat changed_blocks;
+  int32_t since_detection;
+  motion_gate_stats stats;
+
+ public:
+  motion_gate(int32_t keyframe = 30, float sad = 10.0f, float area = 0.002f, double rate = 0.05)
+      : keyframe_interval(std::max(keyframe, 1)),
+        sad_threshold(sad),
+        area_threshold(area),
+        alpha(rate),
+        since_detection(0),
+        stats() {}
+
+  // Whether the frame needs detection; updates the background in any case
+  bool check(const cv::Mat &frame, pixel_format format) {
+    stats.frames++;
+    const int32_t h = (format == pixel_format::i420) ? frame.rows * 2 / 3 : frame.rows;
+    const cv::Size reduced(std::max(frame.cols / SCALE, BLOCK), std::max(h / SCALE, BLOCK));
+    if (format == pixel_format::i420) {
+      cv::resize(frame.rowRange(0, h), luma, reduced, 0, 0, cv::INTER_AREA);
+    } else {
+      cv::resize(frame, small, reduced, 0, 0, cv::INTER_AREA);
+      cv::cvtColor(small, luma, cv::COLOR_BGR2GRAY);
+    }
+
+    // First frame, or the size changed: start a new background and detect
+    if (background.size() != luma.size()) {
+      luma.convertTo(background, CV_32F);
+      luma.copyTo(background_u8);
+      since_detection = 0;
+      stats.changed   = 1.0f;
+      stats.keyframes++;
+      return true;
+    }
+
+    cv::absdiff(luma, background_u8, diff);
+    cv::resize(diff, blocks, cv::Size(luma.cols / BLOCK, luma.rows / BLOCK), 0, 0, cv::INTER_AREA);
+    cv::compare(blocks, sad_threshold, changed_blocks, cv::CMP_GT);
+    const int32_t changed = cv::countNonZero(changed_blocks);
+    stats.changed         = static_cast<float>(changed) / static_cast<float>(blocks.total());
+    cv::accumulateWeighted(luma, background, alpha);
+    background.convertTo(background_u8, CV_8U);
+
+    if (stats.changed >= area_threshold) {
+      stats.motion++;
+    } else if (++since_detection >= keyframe_interval) {
+      stats.keyframes++;
+    } else {
+      stats.skipped++;
+      return false;
+    }
+    since_detection = 0;
+    return true;
+  }
+
+  // Mean SAD of each block for the last frame (CV_8U, 1/16 of the frame size)
+  const cv::Mat &get_motion_map() const { return blocks; }
+
+  motion_gate_stats get_stats() const { return stats; }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/imgproc.hpp>
+#include "yolo.hpp"
+
+/**************************************************************************************************
+  Region-of-interest preparation of frames for HTJ2K encoding
+
+  Everything outside the detected objects is replaced by a low-pass version of itself (down-sampled
+  by `factor` and interpolated back). The high-pass subbands of the background then hold almost
+  nothing, so its code-blocks cost few bytes, while the boxes, grown by a margin and aligned to the
+  code-block grid, keep their original pixels and are coded at the full Qfactor.
+  This is done on the image rather than in the codestream (ROI max-shift): it works the same way
+  for both encoders, and the codestream stays decodable by any JPEG 2000 decoder.
+**************************************************************************************************/
+class roi_filter {
+ private:
+  int32_t factor;  // down-sampling factor of the background
+  int32_t margin;  // pixels added around each box
+  int32_t grid;    // alignment of regions, in pixels of the encoded frame
+  cv::Mat small;
+  cv::Mat out;
+  std::vector<cv::Rect> regions;
+
+ public:
+  roi_filter(int32_t background_factor = 8, int32_t margin_px = 16, int32_t grid_px = 64)
+      : factor(std::max(background_factor, 2)), margin(margin_px), grid(std::max(grid_px, 2) & ~1) {}
+
+  // Returns src itself when there is no detection. The result is valid until the next call.
+  const cv::Mat &apply(const cv::Mat &src, pixel_format format, const std::vector<detection> &dets) {
+    const bool i420 = (format == pixel_format::i420);
+    const int32_t w = src.cols, h = i420 ? src.rows * 2 / 3 : src.rows;
+    set_regions(dets, w, h);
+    if (regions.empty()) {
+      return src;
+    }
+    out.create(src.size(), src.type());
+    if (!i420) {
+      filter_plane(src, out, 1);
+      return out;
+    }
+    // I420 planes are contiguous: Y (w x h), U and V (w/2 x h/2)
+    const size_t luma = static_cast<size_t>(w) * h, chroma = luma / 4;
+    uint8_t *s = src.data, *d = out.data;
+    filter_plane(cv::Mat(h, w, CV_8UC1, s), cv::Mat(h, w, CV_8UC1, d), 1);
+    filter_plane(cv::Mat(h / 2, w / 2, CV_8UC1, s + luma), cv::Mat(h / 2, w / 2, CV_8UC1, d + luma), 2);
+    filter_plane(cv::Mat(h / 2, w / 2, CV_8UC1, s + luma + chroma),
+                 cv::Mat(h / 2, w / 2, CV_8UC1, d + luma + chroma), 2);
+    return out;
+  }
+
+  // Regions kept at full quality by the last apply()
+  const std::vector<cv::Rect> &get_regions() const { return regions; }
+
+ private:
+  void set_regions(const std::vector<detection> &dets, int32_t w, int32_t h) {
+    regions.clear();
+    const cv::Rect frame(0, 0, w, h);
+    for (const auto &d : dets) {
+      const int32_t x0 = (d.box.x - margin) / grid * grid;
+      const int32_t y0 = (d.box.y - margin) / grid * grid;
+      const int32_t x1 = (d.box.x + d.box.width + margin + grid - 1) / grid * grid;
+      const int32_t y1 = (d.box.y + d.box.height + margin + grid - 1) / grid * grid;
+      const cv::Rect r = cv::Rect(x0, y0, x1 - x0, y1 - y0) & frame;
+      if (r.area() > 0) {
+        regions.push_back(r);
+      }
+    }
+  }
+
+  // Low-pass the whole plane, then restore the regions (scaled down by `sub` for chroma)
+  void filter_plane(const cv::Mat &src, cv::Mat dst, int32_t sub) {
+    const cv::Size reduced((src.cols + factor - 1) / factor, (src.rows + factor - 1) / factor);
+    cv::resize(src, small, reduced, 0, 0, cv::INTER_AREA);
+    cv::resize(small, dst, src.size(), 0, 0, cv::INTER_LINEAR);
+    const cv::Rect plane(0, 0, src.cols, src.rows);
+    for (const auto &r : regions) {
+      const cv::Rect rs = cv::Rect(r.x / sub, r.y / sub, r.width / sub, r.height / sub) & plane;
+      src(rs).copyTo(dst(rs));
+    }
+  }
+};
@@ -1,14 +1,20 @@
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <filesystem>
 #include <string>
 #include <vector>
 
-#include "simple_udp.h"
-
-simple_udp udp0("133.36.41.118", 4001);
+#include "simple_udp.hpp"
 
+// usage: send <codestream> [address] [port]
 int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s <codestream> [address] [port]\n", argv[0]);
+    return 1;
+  }
+  const std::string address = (argc > 2) ? argv[2] : "133.36.41.118";
+  const int port            = (argc > 3) ? std::atoi(argv[3]) : 4001;
   FILE *fp = fopen(argv[1], "rb");
   if (fp == nullptr) {
     printf("input file is missing.\n");
@@ -16,15 +22,23 @@ int main(int argc, char **argv) {
   }
   auto fsize = std::filesystem::file_size(argv[1]);
   printf("file size = %lu\n", fsize);
-  
+
   std::vector<uint8_t> data(fsize);
   if (fsize != fread(data.data(), sizeof(uint8_t), fsize, fp)) {
-    // error
+    printf("ERROR: could not read %s\n", argv[1]);
+    fclose(fp);
+    return 1;
   };
   fclose(fp);
-  auto sizeinstr = std::to_string(fsize);
-  udp0.udp_send(sizeinstr);
-  udp0.udp_send(data.data(), fsize);
-  static const int sendSize = 65000; //UDPの仕様により上限は65kB
+  // A single datagram is limited to 65 kB by UDP: the codestream is sent in MTU-sized chunks
+  chunked_udp_sender udp0(address, port);
+  if (udp0.send(data.data(), data.size()) < 0) {
+    return 1;
+  }
+  // Stay around for retransmission requests of lost chunks
+  udp0.serve_nacks(200);
+  const udp_sender_stats st = udp0.get_stats();
+  printf("%lu datagrams, %lu chunks retransmitted\n", static_cast<unsigned long>(st.datagrams),
+         static_cast<unsigned long>(st.retransmitted));
   return 0;
 }
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -6,6 +8,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <iostream>
 #include <string>
 
@@ -14,7 +17,6 @@ class simple_tcp {
   int client_sockfd;
   sockaddr_in addr;
   sockaddr_in from_addr;
-  uint8_t buf[5000000];
 
  public:
   simple_tcp(std::string address, int port) : sockfd(-1), client_sockfd(-1) {
@@ -53,20 +55,24 @@ class simple_tcp {
     return ret;
   }
 
-  int Rx(uint8_t *dst) {
-    int len = 0;
-    memset(buf, 0, sizeof(buf));
-    int rsize = recv(client_sockfd, buf, sizeof(buf), 0);
-    len += rsize;
-    while (rsize > 0) {
-      for (int i = 0; i < rsize; ++i) {
-        dst[i] = buf[i];
+  // Receive until the peer closes or capacity bytes are read, straight into dst; returns the
+  // number of bytes received or -1 on error. See j2c_server.cpp for a multi-client receiver.
+  ssize_t Rx(uint8_t *dst, size_t capacity) {
+    size_t len = 0;
+    while (len < capacity) {
+      const ssize_t rsize = recv(client_sockfd, dst + len, capacity - len, 0);
+      if (rsize < 0 && errno == EINTR) {
+        continue;
+      }
+      if (rsize < 0) {
+        return -1;
+      }
+      if (rsize == 0) {
+        break;
       }
-      dst += rsize;
-      rsize = recv(client_sockfd, buf, sizeof(buf), 0);
-      len += rsize;
+      len += static_cast<size_t>(rsize);
     }
-    return len;
+    return static_cast<ssize_t>(len);
   }
 
   void Tx(uint8_t *src, size_t len) { send(sockfd, src, len, 0); }
@@ -1,13 +1,25 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <random>
 #include <string>
+#include <vector>
 
 #define BUFFER_MAX 4096
 
@@ -30,6 +42,7 @@ class simple_udp {
            sizeof(addr));
   }
 
+  // A single datagram: at most 65507 bytes, use chunked_udp_sender for larger data
   void udp_send(uint8_t *p, size_t length) {
     sendto(sock, p, length, 0, (struct sockaddr *)&addr, sizeof(addr));
   }
@@ -48,7 +61,7 @@ class simple_udp {
   }
 
   void udp_recv(char *buf, size_t size) {
-    memset(buf, 0, sizeof(buf));
+    memset(buf, 0, size);
     recv(sock, buf, size, 0);
     // printf("%ld\n", length);
     // if (length > 0) {
@@ -61,3 +74,591 @@ class simple_udp {
 
   ~simple_udp() { close(sock); }
 };
+
+/**************************************************************************************************
+  Chunked UDP transport for messages larger than a datagram (e.g. HTJ2K codestreams)
+
+  A message is split into chunks that fit the MTU; each datagram carries a 16-byte header
+  (big-endian):
+
+  offset size  field
+       0    2  magic "JC"
+       2    1  type (0: data, 1: NACK)
+       3    1  reserved (0)
+       4    4  message id
+       8    4  message length in bytes
+      12    2  chunk index
+      14    2  number of chunks (NACK: number of chunk indices that follow, 2 bytes each)
+
+  Chunks are sent in batches with sendmmsg() and received with recvmmsg(); the receiver writes
+  them into preallocated per-message buffers, so messages complete independently of each other
+  (no head-of-line blocking). When a message stays incomplete the receiver asks the sender for
+  the missing chunks with a NACK; the sender keeps the last few messages for retransmission.
+  A message that cannot be completed after a few NACKs is dropped and counted as lost.
+**************************************************************************************************/
+constexpr uint16_t UDP_CHUNK_MAGIC  = 0x4A43;
+constexpr size_t UDP_CHUNK_HEADER   = 16;
+constexpr size_t UDP_DEFAULT_MTU    = 1500;
+constexpr size_t UDP_IP_OVERHEAD    = 28;  // IPv4 + UDP headers
+constexpr size_t UDP_BATCH          = 64;  // datagrams per sendmmsg()/recvmmsg()
+constexpr uint8_t UDP_CHUNK_DATA    = 0;
+constexpr uint8_t UDP_CHUNK_NACK    = 1;
+constexpr int32_t UDP_NACK_INTERVAL = 10;  // [ms] silence on an incomplete message before a NACK
+constexpr int32_t UDP_MAX_NACKS     = 5;   // NACKs per message before it is given up
+constexpr size_t UDP_MAX_CHUNKS     = 0xFFFF;
+
+namespace udp_detail {
+struct chunk_header {
+  uint8_t type;
+  uint32_t id;
+  uint32_t length;
+  uint16_t index;
+  uint16_t count;
+};
+
+inline void put_header(uint8_t *p, const chunk_header &h) {
+  const uint16_t magic = htons(UDP_CHUNK_MAGIC), index = htons(h.index), count = htons(h.count);
+  const uint32_t id = htonl(h.id), length = htonl(h.length);
+  std::memcpy(p, &magic, 2);
+  p[2] = h.type;
+  p[3] = 0;
+  std::memcpy(p + 4, &id, 4);
+  std::memcpy(p + 8, &length, 4);
+  std::memcpy(p + 12, &index, 2);
+  std::memcpy(p + 14, &count, 2);
+}
+
+inline bool get_header(const uint8_t *p, size_t len, chunk_header &h) {
+  uint16_t magic, index, count;
+  uint32_t id, length;
+  if (len < UDP_CHUNK_HEADER) {
+    return false;
+  }
+  std::memcpy(&magic, p, 2);
+  std::memcpy(&id, p + 4, 4);
+  std::memcpy(&length, p + 8, 4);
+  std::memcpy(&index, p + 12, 2);
+  std::memcpy(&count, p + 14, 2);
+  h.type   = p[2];
+  h.id     = ntohl(id);
+  h.length = ntohl(length);
+  h.index  = ntohs(index);
+  h.count  = ntohs(count);
+  return ntohs(magic) == UDP_CHUNK_MAGIC;
+}
+
+inline size_t chunk_payload(size_t mtu) { return mtu - UDP_IP_OVERHEAD - UDP_CHUNK_HEADER; }
+
+inline bool make_address(const std::string &address, int port, sockaddr_in &addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  return inet_pton(AF_INET, address.c_str(), &addr.sin_addr) == 1;
+}
+
+inline void set_buffer_size(int sock, int option, int bytes) {
+  setsockopt(sock, SOL_SOCKET, option, &bytes, sizeof(bytes));
+}
+}  // namespace udp_detail
+
+struct udp_sender_stats {
+  uint64_t messages;       // messages sent
+  uint64_t datagrams;      // datagrams sent, including retransmissions
+  uint64_t nacks;          // NACKs received
+  uint64_t retransmitted;  // chunks sent again on request
+  uint64_t expired;        // requested chunks of messages no longer retained
+};
+
+/**************************************************************************************************
+  Sending side of the chunked transport
+
+  send() blocks until all datagrams of a message are handed to the kernel. With a retransmission
+  depth > 0 the last messages are copied and NACKs are served by send() and serve_nacks();
+  with depth 0 the caller's buffer is sent as is and NACKs are ignored.
+**************************************************************************************************/
+class chunked_udp_sender {
+ private:
+  struct retained {
+    uint32_t id;
+    std::vector<uint8_t> data;
+  };
+
+  int sock;
+  size_t chunk_size;
+  size_t depth;
+  uint32_t next_id;
+  std::deque<retained> history;
+  std::vector<uint8_t> headers;
+  std::vector<iovec> iovs;
+  std::vector<mmsghdr> msgs;
+  std::vector<uint8_t> nack_buf;
+  std::vector<uint16_t> indices;
+  double drop_rate;
+  std::mt19937 rng;
+  udp_sender_stats stats;
+
+ public:
+  chunked_udp_sender(const std::string &address, int port, size_t mtu = UDP_DEFAULT_MTU,
+                     size_t retransmit_depth = 4)
+      : sock(-1),
+        chunk_size(udp_detail::chunk_payload(mtu)),
+        depth(retransmit_depth),
+        next_id(0),
+        headers(UDP_BATCH * UDP_CHUNK_HEADER),
+        iovs(UDP_BATCH * 2),
+        msgs(UDP_BATCH),
+        nack_buf(mtu),
+        drop_rate(0.0),
+        rng(1),
+        stats() {
+    sockaddr_in addr;
+    if (mtu <= UDP_IP_OVERHEAD + UDP_CHUNK_HEADER || mtu > 65535
+        || !udp_detail::make_address(address, port, addr)) {
+      printf("ERROR: invalid UDP destination %s:%d (MTU %zu)\n", address.c_str(), port, mtu);
+      throw std::exception();
+    }
+    // Connected: sendmmsg() needs no addresses and only the receiver's NACKs are accepted
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      printf("ERROR: cannot open UDP socket to %s:%d (%s)\n", address.c_str(), port, strerror(errno));
+      if (sock >= 0) close(sock);
+      throw std::exception();
+    }
+    udp_detail::set_buffer_size(sock, SO_SNDBUF, 4 << 20);
+  }
+
+  ~chunked_udp_sender() { close(sock); }
+
+  chunked_udp_sender(const chunked_udp_sender &)            = delete;
+  chunked_udp_sender &operator=(const chunked_udp_sender &) = delete;
+
+  // Returns the message id, or -1 if the message is too large or the socket failed
+  int64_t send(const uint8_t *data, size_t length) {
+    if ((length + chunk_size - 1) / chunk_size > UDP_MAX_CHUNKS || length > UINT32_MAX) {
+      printf("ERROR: message of %zu bytes exceeds %zu chunks\n", length, UDP_MAX_CHUNKS);
+      return -1;
+    }
+    serve_nacks(0);
+    const uint32_t id = next_id++;
+    if (depth > 0) {
+      // Reuse the capacity of the oldest retained message
+      retained r;
+      if (history.size() >= depth) {
+        r = std::move(history.front());
+        history.pop_front();
+      }
+      r.id = id;
+      r.data.assign(data, data + length);
+      history.push_back(std::move(r));
+      data = history.back().data.data();
+    }
+    if (!send_chunks(id, data, length, nullptr, chunk_count(length))) {
+      return -1;
+    }
+    stats.messages++;
+    return id;
+  }
+
+  // Retransmit chunks requested by NACKs that arrive within timeout_ms
+  void serve_nacks(int32_t timeout_ms) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      const ssize_t r = recv(sock, nack_buf.data(), nack_buf.size(), MSG_DONTWAIT);
+      if (r >= 0) {
+        handle_nack(static_cast<size_t>(r));
+        continue;
+      }
+      if (errno == EINTR || errno == ECONNREFUSED) {
+        continue;
+      }
+      const auto now  = std::chrono::steady_clock::now();
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+      if (left <= 0) {
+        return;
+      }
+      pollfd p = {sock, POLLIN, 0};
+      poll(&p, 1, static_cast<int>(left));
+    }
+  }
+
+  // Discard a fraction of the datagrams (first transmissions only) to exercise retransmission
+  void set_drop_rate(double rate) { drop_rate = rate; }
+
+  size_t get_chunk_size() const { return chunk_size; }
+
+  udp_sender_stats get_stats() const { return stats; }
+
+ private:
+  uint16_t chunk_count(size_t length) const {
+    return static_cast<uint16_t>(std::max<size_t>(1, (length + chunk_size - 1) / chunk_size));
+  }
+
+  // Send the chunks listed in idx (all count chunks if idx is null) in batches of UDP_BATCH
+  bool send_chunks(uint32_t id, const uint8_t *data, size_t length, const uint16_t *idx, size_t n) {
+    const uint16_t count = chunk_count(length);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    size_t i = 0;
+    while (i < n) {
+      size_t batch = 0;
+      for (; i < n && batch < UDP_BATCH; ++i) {
+        const uint16_t c = idx ? idx[i] : static_cast<uint16_t>(i);
+        if (c >= count || (!idx && drop_rate > 0.0 && coin(rng) < drop_rate)) {
+          continue;
+        }
+        const size_t offset = c * chunk_size;
+        const size_t len    = std::min(chunk_size, length - offset);
+        uint8_t *hdr        = headers.data() + batch * UDP_CHUNK_HEADER;
+        udp_detail::put_header(hdr, {UDP_CHUNK_DATA, id, static_cast<uint32_t>(length), c, count});
+        iovs[2 * batch]                = {hdr, UDP_CHUNK_HEADER};
+        iovs[2 * batch + 1]            = {const_cast<uint8_t *>(data) + offset, len};
+        msgs[batch]                    = {};
+        msgs[batch].msg_hdr.msg_iov    = &iovs[2 * batch];
+        msgs[batch].msg_hdr.msg_iovlen = 2;
+        ++batch;
+      }
+      size_t done = 0;
+      while (done < batch) {
+        const int r = sendmmsg(sock, msgs.data() + done, static_cast<unsigned>(batch - done), 0);
+        if (r > 0) {
+          done += static_cast<size_t>(r);
+          stats.datagrams += static_cast<uint64_t>(r);
+        } else if (errno == ECONNREFUSED) {
+          done++;  // ICMP port unreachable of an earlier datagram: nobody is listening yet
+        } else if (errno == ENOBUFS || errno == EAGAIN) {
+          pollfd p = {sock, POLLOUT, 0};
+          poll(&p, 1, 10);
+        } else if (errno != EINTR) {
+          printf("ERROR: sendmmsg failed (%s)\n", strerror(errno));
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void handle_nack(size_t len) {
+    udp_detail::chunk_header h;
+    if (!udp_detail::get_header(nack_buf.data(), len, h) || h.type != UDP_CHUNK_NACK
+        || UDP_CHUNK_HEADER + 2 * static_cast<size_t>(h.count) > len) {
+      return;
+    }
+    stats.nacks++;
+    auto it = std::find_if(history.begin(), history.end(), [&](const retained &r) { return r.id == h.id; });
+    if (it == history.end()) {
+      stats.expired += h.count;
+      return;
+    }
+    indices.resize(h.count);
+    for (size_t i = 0; i < h.count; ++i) {
+      uint16_t v;
+      std::memcpy(&v, nack_buf.data() + UDP_CHUNK_HEADER + 2 * i, 2);
+      indices[i] = ntohs(v);
+    }
+    if (send_chunks(h.id, it->data.data(), it->data.size(), indices.data(), indices.size())) {
+      stats.retransmitted += h.count;
+    }
+  }
+};
+
+// Complete message; data stays valid until the next call of receive()
+struct udp_message {
+  uint32_t id;
+  const uint8_t *data;
+  size_t length;
+};
+
+struct udp_receiver_stats {
+  uint64_t messages;    // messages delivered
+  uint64_t datagrams;   // valid data datagrams received
+  uint64_t duplicates;  // chunks received more than once
+  uint64_t nacks;       // NACKs sent
+  uint64_t lost;        // messages given up or evicted incomplete
+  uint64_t invalid;     // datagrams with a bad header or a message larger than the buffers
+};
+
+/**************************************************************************************************
+  Receiving side of the chunked transport
+
+  Up to num_slots messages are reassembled at a time, each into its own buffer of
+  max_message_size bytes allocated once. Completed messages are delivered in completion order.
+**************************************************************************************************/
+class chunked_udp_receiver {
+ private:
+  using clock = std::chrono::steady_clock;
+  struct slot {
+    bool active;
+    bool complete;
+    uint32_t id;
+    uint32_t length;
+    uint16_t count;
+    uint16_t received;
+    int32_t nacks;
+    clock::time_point last_rx;
+    clock::time_point last_nack;
+    sockaddr_in from;
+    std::vector<uint8_t> have;  // one flag per chunk
+    std::vector<uint8_t> buf;
+  };
+
+  int sock;
+  const size_t chunk_size;
+  const size_t max_message;
+  const bool nack;
+  std::vector<slot> slots;
+  std::deque<size_t> ready;     // completed slots in completion order
+  std::deque<uint32_t> recent;  // ids delivered or given up, to ignore late retransmissions
+  int64_t held;                 // slot returned by the last receive()
+  std::vector<uint8_t> rx;
+  std::vector<iovec> iovs;
+  std::vector<mmsghdr> msgs;
+  std::vector<sockaddr_in> from;
+  size_t rx_count;  // datagrams of the last recvmmsg()
+  size_t rx_next;   // first datagram not placed yet
+  std::vector<uint8_t> nack_buf;
+  udp_receiver_stats stats;
+
+ public:
+  chunked_udp_receiver(const std::string &address, int port, size_t max_message_size,
+                       size_t mtu = UDP_DEFAULT_MTU, bool enable_nack = true, size_t num_slots = 4)
+      : sock(-1),
+        chunk_size(udp_detail::chunk_payload(mtu)),
+        max_message(max_message_size),
+        nack(enable_nack),
+        slots(std::max<size_t>(num_slots, 1)),
+        held(-1),
+        rx(UDP_BATCH * mtu),
+        iovs(UDP_BATCH),
+        msgs(UDP_BATCH),
+        from(UDP_BATCH),
+        rx_count(0),
+        rx_next(0),
+        nack_buf(mtu),
+        stats() {
+    sockaddr_in addr;
+    if (mtu <= UDP_IP_OVERHEAD + UDP_CHUNK_HEADER || mtu > 65535
+        || !udp_detail::make_address(address, port, addr)) {
+      printf("ERROR: invalid UDP address %s:%d (MTU %zu)\n", address.c_str(), port, mtu);
+      throw std::exception();
+    }
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      printf("ERROR: cannot bind UDP socket to %s:%d (%s)\n", address.c_str(), port, strerror(errno));
+      if (sock >= 0) close(sock);
+      throw std::exception();
+    }
+    // A burst of a whole codestream has to fit (capped by net.core.rmem_max)
+    udp_detail::set_buffer_size(sock, SO_RCVBUF, 8 << 20);
+    for (auto &s : slots) {
+      s.active   = false;
+      s.complete = false;
+      s.buf.resize(max_message);
+      s.have.resize(std::max<size_t>(1, (max_message + chunk_size - 1) / chunk_size));
+    }
+    for (size_t i = 0; i < UDP_BATCH; ++i) {
+      iovs[i]                     = {rx.data() + i * mtu, mtu};
+      msgs[i]                     = {};
+      msgs[i].msg_hdr.msg_iov     = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen  = 1;
+      msgs[i].msg_hdr.msg_name    = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+  }
+
+  ~chunked_udp_receiver() { close(sock); }
+
+  chunked_udp_receiver(const chunked_udp_receiver &)            = delete;
+  chunked_udp_receiver &operator=(const chunked_udp_receiver &) = delete;
+
+  // Wait up to timeout_ms for a complete message
+  bool receive(udp_message &msg, int32_t timeout_ms) {
+    if (held >= 0) {
+      release(slots[static_cast<size_t>(held)]);
+      held = -1;
+    }
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (ready.empty()) {
+      if (rx_next < rx_count) {
+        place_pending();
+        continue;
+      }
+      const auto now  = clock::now();
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+      if (left <= 0) {
+        return false;
+      }
+      pollfd p = {sock, POLLIN, 0};
+      if (poll(&p, 1, static_cast<int>(std::min<int64_t>(left, UDP_NACK_INTERVAL))) > 0) {
+        receive_batch();
+        place_pending();
+      }
+      check_incomplete();
+    }
+    held = static_cast<int64_t>(ready.front());
+    ready.pop_front();
+    const slot &s = slots[static_cast<size_t>(held)];
+    msg           = {s.id, s.buf.data(), s.length};
+    stats.messages++;
+    return true;
+  }
+
+  size_t get_chunk_size() const { return chunk_size; }
+
+  udp_receiver_stats get_stats() const { return stats; }
+
+ private:
+  void receive_batch() {
+    for (auto &m : msgs) {
+      m.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+    const int n = recvmmsg(sock, msgs.data(), UDP_BATCH, MSG_DONTWAIT, nullptr);
+    rx_count    = (n > 0) ? static_cast<size_t>(n) : 0;
+    rx_next     = 0;
+  }
+
+  // Stops at a datagram of a new message while every slot holds a complete message; it is placed
+  // once the caller has taken one of them
+  void place_pending() {
+    for (; rx_next < rx_count; ++rx_next) {
+      const uint8_t *p = static_cast<const uint8_t *>(iovs[rx_next].iov_base);
+      if (!place(p, msgs[rx_next].msg_len, from[rx_next])) {
+        return;
+      }
+    }
+  }
+
+  // false if the datagram has to wait for a free slot
+  bool place(const uint8_t *p, size_t len, const sockaddr_in &src) {
+    udp_detail::chunk_header h;
+    if (!udp_detail::get_header(p, len, h) || h.type != UDP_CHUNK_DATA || h.length > max_message
+        || h.index >= h.count || h.count != std::max<size_t>(1, (h.length + chunk_size - 1) / chunk_size)) {
+      stats.invalid++;
+      return true;
+    }
+    const size_t offset = h.index * chunk_size;
+    const size_t bytes  = std::min(chunk_size, h.length - offset);
+    if (len - UDP_CHUNK_HEADER != bytes) {
+      stats.invalid++;
+      return true;
+    }
+    if (std::find(recent.begin(), recent.end(), h.id) != recent.end()) {
+      stats.datagrams++;
+      stats.duplicates++;
+      return true;
+    }
+    slot *s = find_slot(h.id);
+    if (s == nullptr) {
+      s = allocate_slot(h);
+      if (s == nullptr) {
+        return false;
+      }
+    }
+    stats.datagrams++;
+    if (s->complete || s->have[h.index]) {
+      stats.duplicates++;
+      return true;
+    }
+    std::memcpy(s->buf.data() + offset, p + UDP_CHUNK_HEADER, bytes);
+    s->have[h.index] = 1;
+    s->received++;
+    s->last_rx = clock::now();
+    s->from    = src;
+    if (s->received == s->count) {
+      s->complete = true;
+      ready.push_back(static_cast<size_t>(s - slots.data()));
+    }
+    return true;
+  }
+
+  slot *find_slot(uint32_t id) {
+    for (auto &s : slots) {
+      if (s.active && s.id == id) return &s;
+    }
+    return nullptr;
+  }
+
+  // A free slot, or the oldest incomplete one (which is then lost); null if all are complete
+  slot *allocate_slot(const udp_detail::chunk_header &h) {
+    slot *victim = nullptr;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      slot &s = slots[i];
+      if (!s.active) {
+        victim = &s;
+        break;
+      }
+      if (!s.complete && (victim == nullptr || static_cast<int32_t>(s.id - victim->id) < 0)) {
+        victim = &s;
+      }
+    }
+    if (victim == nullptr) {
+      return nullptr;
+    }
+    if (victim->active) {
+      stats.lost++;
+      remember(victim->id);
+    }
+    victim->active   = true;
+    victim->complete = false;
+    victim->id       = h.id;
+    victim->length   = h.length;
+    victim->count    = h.count;
+    victim->received = 0;
+    victim->nacks    = 0;
+    victim->last_rx  = victim->last_nack = clock::now();
+    std::fill(victim->have.begin(), victim->have.begin() + h.count, 0);
+    return victim;
+  }
+
+  void release(slot &s) {
+    remember(s.id);
+    s.active   = false;
+    s.complete = false;
+  }
+
+  void remember(uint32_t id) {
+    recent.push_back(id);
+    if (recent.size() > 4 * slots.size()) {
+      recent.pop_front();
+    }
+  }
+
+  // Request missing chunks of stalled messages, and give up on those that stay incomplete
+  void check_incomplete() {
+    const auto now      = clock::now();
+    const auto interval = std::chrono::milliseconds(UDP_NACK_INTERVAL);
+    for (auto &s : slots) {
+      if (!s.active || s.complete || now - s.last_rx < interval || now - s.last_nack < interval) {
+        continue;
+      }
+      if (!nack || s.nacks >= UDP_MAX_NACKS) {
+        stats.lost++;
+        release(s);
+        continue;
+      }
+      send_nack(s);
+      s.nacks++;
+      s.last_nack = now;
+    }
+  }
+
+  void send_nack(const slot &s) {
+    const size_t max_entries = std::min<size_t>((nack_buf.size() - UDP_CHUNK_HEADER) / 2, UDP_MAX_CHUNKS);
+    size_t c                 = 0;
+    while (c < s.count) {
+      size_t n = 0;
+      for (; c < s.count && n < max_entries; ++c) {
+        if (!s.have[c]) {
+          const uint16_t v = htons(static_cast<uint16_t>(c));
+          std::memcpy(nack_buf.data() + UDP_CHUNK_HEADER + 2 * n++, &v, 2);
+        }
+      }
+      if (n == 0) {
+        break;
+      }
+      const udp_detail::chunk_header h = {UDP_CHUNK_NACK, s.id, s.length, 0, static_cast<uint16_t>(n)};
+      udp_detail::put_header(nack_buf.data(), h);
+      sendto(sock, nack_buf.data(), UDP_CHUNK_HEADER + 2 * n, 0,
+             reinterpret_cast<const sockaddr *>(&s.from), sizeof(s.from));
+      stats.nacks++;
+    }
+  }
+};
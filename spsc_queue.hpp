@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Behaviour of push() when the ring is full
+enum class queue_policy {
+  block,       // producer waits until the consumer frees a slot (backpressure)
+  drop_oldest  // producer evicts the oldest queued element and never waits
+};
+
+// Snapshot of queue counters
+struct queue_stats {
+  size_t depth;      // elements currently queued
+  uint64_t pushed;   // elements accepted by push()
+  uint64_t popped;   // elements handed to the consumer
+  uint64_t dropped;  // elements evicted by drop_oldest
+  uint64_t stalls;   // number of times the producer found the ring full
+  uint64_t starved;  // number of times the consumer had to wait on an empty ring
+};
+
+/**************************************************************************************************
+  Bounded single-producer/single-consumer ring buffer
+
+  Each slot carries a sequence number (slot is free when seq == write position, filled when
+  seq == read position + 1). Both sides claim an element by CAS on the read position, which lets
+  the producer evict the oldest element under drop_oldest without racing the consumer.
+  Waiting sides spin briefly and then park on a condition variable; the fast paths are lock-free.
+**************************************************************************************************/
+template <typename T>
+class spsc_queue {
+ private:
+  struct slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  static constexpr int32_t SPIN_COUNT = 64;
+
+  const size_t capacity;
+  const queue_policy policy;
+  std::unique_ptr<slot[]> slots;
+  alignas(64) std::atomic<size_t> rpos;
+  alignas(64) size_t wpos;  // only touched by the producer
+  alignas(64) std::atomic<bool> closed;
+  std::atomic<int32_t> waiters;
+  std::mutex park_mutex;
+  std::condition_variable park_cv;
+
+  std::atomic<uint64_t> n_pushed, n_popped, n_dropped, n_stalls, n_starved;
+
+ public:
+  spsc_queue(size_t cap, queue_policy p)
+      : capacity(cap),
+        policy(p),
+        slots(new slot[cap]),
+        rpos(0),
+        wpos(0),
+        closed(false),
+        waiters(0),
+        n_pushed(0),
+        n_popped(0),
+        n_dropped(0),
+        n_stalls(0),
+        n_starved(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  spsc_queue(const spsc_queue &)            = delete;
+  spsc_queue &operator=(const spsc_queue &) = delete;
+
+  // Returns false only if the queue has been closed
+  bool push(T &&v) {
+    slot &s    = slots[wpos % capacity];
+    bool stall = false;
+    for (int32_t spin = 0; s.seq.load(std::memory_order_acquire) != wpos; ++spin) {
+      if (closed.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (!stall) {
+        stall = true;
+        n_stalls.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (policy == queue_policy::drop_oldest) {
+        // The oldest element lives in the very slot we want to write
+        size_t r = wpos - capacity;
+        if (rpos.compare_exchange_strong(r, r + 1, std::memory_order_acq_rel)) {
+          s.value = T();  // release the evicted element
+          n_dropped.fetch_add(1, std::memory_order_relaxed);
+          break;
+        }
+        // the consumer won the race; it is moving the element out right now
+        std::this_thread::yield();
+      } else {
+        backoff(spin, [&] { return s.seq.load(std::memory_order_acquire) == wpos; });
+      }
+    }
+    s.value = std::move(v);
+    s.seq.store(wpos + 1, std::memory_order_release);
+    ++wpos;
+    n_pushed.fetch_add(1, std::memory_order_relaxed);
+    wake();
+    return true;
+  }
+
+  // Non-blocking pop
+  bool try_pop(T &out) {
+    size_t r = rpos.load(std::memory_order_relaxed);
+    while (true) {
+      slot &s = slots[r % capacity];
+      if (s.seq.load(std::memory_order_acquire) != r + 1) {
+        return false;
+      }
+      if (rpos.compare_exchange_weak(r, r + 1, std::memory_order_acq_rel)) {
+        out = std::move(s.value);
+        s.seq.store(r + capacity, std::memory_order_release);
+        n_popped.fetch_add(1, std::memory_order_relaxed);
+        wake();
+        return true;
+      }
+    }
+  }
+
+  // Blocking pop; returns false on timeout or when the queue is closed and drained
+  bool pop(T &out, std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+    if (try_pop(out)) {
+      return true;
+    }
+    n_starved.fetch_add(1, std::memory_order_relaxed);
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (int32_t spin = 0;; ++spin) {
+      if (try_pop(out)) {
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire) || std::chrono::steady_clock::now() >= deadline) {
+        return try_pop(out);
+      }
+      backoff(spin, [&] { return !empty(); }, deadline);
+    }
+  }
+
+  // Wake up all waiters; subsequent push() calls fail, pop() drains what is left
+  void close() {
+    closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(park_mutex);
+    park_cv.notify_all();
+  }
+
+  bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+  bool empty() const {
+    size_t r = rpos.load(std::memory_order_acquire);
+    return slots[r % capacity].seq.load(std::memory_order_acquire) != r + 1;
+  }
+
+  size_t depth() const {
+    const uint64_t in  = n_pushed.load(std::memory_order_relaxed);
+    const uint64_t out =
+        n_popped.load(std::memory_order_relaxed) + n_dropped.load(std::memory_order_relaxed);
+    return (in > out) ? static_cast<size_t>(in - out) : 0;
+  }
+
+  queue_stats get_stats() const {
+    return {depth(),
+            n_pushed.load(std::memory_order_relaxed),
+            n_popped.load(std::memory_order_relaxed),
+            n_dropped.load(std::memory_order_relaxed),
+            n_stalls.load(std::memory_order_relaxed),
+            n_starved.load(std::memory_order_relaxed)};
+  }
+
+ private:
+  using time_point = std::chrono::steady_clock::time_point;
+
+  template <typename Pred>
+  void backoff(int32_t spin, Pred ready, time_point deadline = time_point::max()) {
+    if (spin < SPIN_COUNT) {
+      std::this_thread::yield();
+      return;
+    }
+    std::unique_lock<std::mutex> lock(park_mutex);
+    waiters.fetch_add(1, std::memory_order_acq_rel);
+    // bounded wait guards against a wake-up issued between the check and the park
+    auto until = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+    park_cv.wait_until(lock, until, [&] { return ready() || closed.load(std::memory_order_acquire); });
+    waiters.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  void wake() {
+    if (waiters.load(std::memory_order_acquire) > 0) {
+      std::lock_guard<std::mutex> lock(park_mutex);
+      park_cv.notify_all();
+    }
+  }
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spsc_queue.hpp"
+
+#ifndef SO_ZEROCOPY
+  #define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+  #define MSG_ZEROCOPY 0x4000000
+#endif
+
+// Snapshot of sender counters
+struct sender_stats {
+  size_t queued;        // messages waiting to be sent
+  uint64_t sent;        // messages completely written to the socket
+  uint64_t bytes;       // payload bytes of sent messages
+  uint64_t dropped;     // messages evicted from a full queue
+  uint64_t resent;      // messages restarted on a new connection after a partial send
+  uint64_t reconnects;  // successful connections
+  bool connected;
+};
+
+/**************************************************************************************************
+  Persistent TCP connection with an asynchronous send queue
+
+  send() only enqueues and never blocks: when the receiver is down or slow the queue drops its
+  oldest message. A worker thread owns a non-blocking socket, connects with exponential backoff,
+  and writes each message, a header (see wire_protocol.hpp) followed by the payload, with one
+  writev() (sendmsg()). Partial writes are resumed where they stopped; a message that cannot be completed
+  within the stall timeout causes a reconnect, and the message is sent again from its start so
+  the stream stays framed. There are no acknowledgements: messages already handed to the kernel
+  when the receiver closes the connection are lost.
+  Payloads of at least ZEROCOPY_THRESHOLD bytes are sent with MSG_ZEROCOPY if the kernel supports
+  it; their buffers are kept alive until the completion notification arrives on the error queue.
+  send() shall be called from a single thread.
+**************************************************************************************************/
+class tcp_sender {
+ private:
+  // The header lives with the payload: both are referenced by zerocopy sends
+  struct framed {
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> payload;
+  };
+  using message = std::shared_ptr<framed>;
+  struct zc_pending {
+    uint32_t id;  // notification id of the last sendmsg() that referenced the payload
+    message payload;
+  };
+  static constexpr size_t ZEROCOPY_THRESHOLD  = 16384;
+  static constexpr int32_t BACKOFF_MIN_MS     = 100;
+  static constexpr int32_t BACKOFF_MAX_MS     = 5000;
+  static constexpr int32_t CONNECT_TIMEOUT_MS = 1000;
+  static constexpr int32_t STALL_TIMEOUT_MS   = 3000;
+
+  sockaddr_in addr;
+  spsc_queue<message> queue;
+  std::thread worker;
+  std::atomic<bool> running;
+  int fd;
+  bool zerocopy;
+  uint32_t zc_next;  // id of the next zerocopy sendmsg()
+  std::deque<zc_pending> zc_inflight;
+  std::atomic<uint64_t> n_sent, n_bytes, n_resent, n_reconnects;
+  std::atomic<bool> connected;
+
+ public:
+  tcp_sender(const std::string &address, int port, size_t max_queued = 8)
+      : queue(max_queued, queue_policy::drop_oldest),
+        running(false),
+        fd(-1),
+        zerocopy(false),
+        zc_next(0),
+        n_sent(0),
+        n_bytes(0),
+        n_resent(0),
+        n_reconnects(0),
+        connected(false) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+      printf("ERROR: invalid address %s\n", address.c_str());
+      throw std::exception();
+    }
+    running = true;
+    worker  = std::thread([this] { run(); });
+  }
+
+  ~tcp_sender() { stop(); }
+
+  tcp_sender(const tcp_sender &)            = delete;
+  tcp_sender &operator=(const tcp_sender &) = delete;
+
+  // Enqueue a payload; returns false once stopped
+  bool send(std::vector<uint8_t> &&header, std::vector<uint8_t> &&payload) {
+    message m  = std::make_shared<framed>();
+    m->header  = std::move(header);
+    m->payload = std::move(payload);
+    return queue.push(std::move(m));
+  }
+
+  // Messages still queued are sent if connected, then the connection is closed; if the receiver fails
+  // meanwhile (e.g. stalls for STALL_TIMEOUT_MS), the remaining messages are dropped
+  void stop() {
+    if (!running.exchange(false)) {
+      return;
+    }
+    queue.close();
+    worker.join();
+  }
+
+  sender_stats get_stats() const {
+    const queue_stats q = queue.get_stats();
+    return {q.depth,         n_sent.load(),       n_bytes.load(),  q.dropped,
+            n_resent.load(), n_reconnects.load(), connected.load()};
+  }
+
+ private:
+  void run() {
+    int32_t backoff = BACKOFF_MIN_MS;
+    message m;
+    bool have = false;
+    while (true) {
+      if (!have) {
+        have = queue.pop(m);
+        if (!have) {
+          if (queue.is_closed()) break;
+          reap_completions();
+          continue;
+        }
+      }
+      if (fd < 0 && !open_connection()) {
+        if (queue.is_closed()) break;  // nobody to deliver the rest to
+        sleep_ms(backoff);
+        backoff = std::min(backoff * 2, BACKOFF_MAX_MS);
+        continue;
+      }
+      backoff = BACKOFF_MIN_MS;
+      if (write_message(m)) {
+        n_sent.fetch_add(1);
+        n_bytes.fetch_add(m->payload.size());
+        m.reset();
+        have = false;
+      } else {
+        close_connection(false);
+        if (queue.is_closed()) break;  // stopping: no retry of a failed receiver, the rest is dropped
+        n_resent.fetch_add(1);
+      }
+    }
+    close_connection(true);
+  }
+
+  bool open_connection() {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return false;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    zerocopy = (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == 0);
+    zc_next  = 0;
+
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      if (errno != EINPROGRESS || !wait_fd(POLLOUT, CONNECT_TIMEOUT_MS)) {
+        close_connection(false);
+        return false;
+      }
+      int err       = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err != 0) {
+        close_connection(false);
+        return false;
+      }
+    }
+    n_reconnects.fetch_add(1);
+    connected = true;
+    return true;
+  }
+
+  // A graceful close lets queued data go out; otherwise the connection is reset so that the kernel
+  // stops reading zerocopy buffers before they are freed
+  void close_connection(bool graceful) {
+    if (fd >= 0) {
+      if (graceful) {
+        const auto t_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(STALL_TIMEOUT_MS);
+        while (!zc_inflight.empty() && std::chrono::steady_clock::now() < t_end) {
+          wait_fd(0, 10);  // POLLERR: notifications on the error queue
+          reap_completions();
+        }
+      }
+      if (!graceful || !zc_inflight.empty()) {
+        linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+      }
+      close(fd);
+      fd = -1;
+    }
+    zc_inflight.clear();
+    connected = false;
+  }
+
+  // Write header + payload, resuming partial writes; false if the connection has to be reopened
+  bool write_message(const message &m) {
+    uint8_t *header               = m->header.data();
+    const size_t hlen             = m->header.size();
+    std::vector<uint8_t> &payload = m->payload;
+    const bool zc                 = zerocopy && payload.size() >= ZEROCOPY_THRESHOLD;
+    const size_t total            = hlen + payload.size();
+    size_t done                   = 0;
+    auto t_stall                  = std::chrono::steady_clock::now();
+    while (done < total) {
+      iovec iov[2];
+      int32_t n = 0;
+      if (done < hlen) {
+        iov[n++] = {header + done, hlen - done};
+        iov[n++] = {payload.data(), payload.size()};
+      } else {
+        iov[n++] = {payload.data() + (done - hlen), total - done};
+      }
+      msghdr msg      = {};
+      msg.msg_iov     = iov;
+      msg.msg_iovlen  = n;
+      const ssize_t r = sendmsg(fd, &msg, MSG_NOSIGNAL | (zc ? MSG_ZEROCOPY : 0));
+      if (r > 0) {
+        done += static_cast<size_t>(r);
+        t_stall = std::chrono::steady_clock::now();
+        if (zc) {
+          zc_inflight.push_back({zc_next++, m});
+        }
+        continue;
+      }
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+        // Backpressure: wait for space, reap zerocopy completions meanwhile
+        reap_completions();
+        const auto stalled = std::chrono::steady_clock::now() - t_stall;
+        if (stalled > std::chrono::milliseconds(STALL_TIMEOUT_MS)) {
+          printf("WARNING: receiver stalled, reconnecting\n");
+          return false;
+        }
+        wait_fd(POLLOUT, 100);
+        continue;
+      }
+      return false;  // connection reset, broken pipe, ...
+    }
+    reap_completions();
+    return true;
+  }
+
+  // Release payloads whose zerocopy transmissions have completed
+  void reap_completions() {
+    if (fd < 0 || zc_inflight.empty()) {
+      return;
+    }
+    while (true) {
+      char control[128];
+      msghdr msg         = {};
+      msg.msg_control    = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        return;
+      }
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+        const sock_extended_err *ee = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+        if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+          continue;
+        }
+        // Notifications cover the id range [ee_info, ee_data]
+        const uint32_t hi = ee->ee_data;
+        while (!zc_inflight.empty() && static_cast<int32_t>(zc_inflight.front().id - hi) <= 0) {
+          zc_inflight.pop_front();
+        }
+      }
+    }
+  }
+
+  // Errors are picked up by the following getsockopt()/sendmsg()
+  bool wait_fd(short events, int32_t timeout_ms) {
+    pollfd p = {fd, events, 0};
+    return poll(&p, 1, timeout_ms) > 0;
+  }
+
+  static void sleep_ms(int32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+};
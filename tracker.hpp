@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "yolo.hpp"
+
+// Object kept across frames
+struct tracked_object {
+  uint32_t id;  // unique for the lifetime of the tracker, starting at 1
+  int32_t class_id;
+  float score;     // of the last matched detection
+  cv::Rect box;    // filtered, or predicted when not matched in this frame
+  bool predicted;  // no detection matched in this frame
+  bool is_new;     // confirmed in this frame
+};
+
+/**************************************************************************************************
+  Multi-object tracking between detections (SORT-like)
+
+  Each track filters the centre, width and height of its box with constant velocity Kalman filters
+  (one per coordinate, so the covariances stay 2x2). predict() advances all tracks by one frame and
+  is called on frames without inference; update() does the same and then matches detections of
+  the same class to the predicted boxes, greedily by decreasing IoU. Unmatched detections start
+  tentative tracks that are confirmed after `min_hits` matches; tracks missing `max_misses`
+  detection rounds in a row, coasting on predictions for more than `max_coast` frames (e.g. through
+  frames skipped by a motion gate) or leaving the frame are dropped. Reported boxes are clipped to
+  the frame. Only confirmed tracks are reported, and `is_new` marks the frame where a track was
+  confirmed, so that events fire once per object rather than per frame.
+  Tracks and match candidates live in fixed arrays and the output vector keeps its capacity: no
+  allocation after construction.
+**************************************************************************************************/
+class tracker {
+ private:
+  static constexpr size_t MAX_TRACKS     = 64;
+  static constexpr size_t MAX_DETECTIONS = 64;
+  static constexpr float MEASUREMENT_VAR = 4.0f;   // [px^2]
+  static constexpr float POSITION_VAR    = 1.0f;   // process noise [px^2/frame]
+  static constexpr float VELOCITY_VAR    = 0.25f;  // process noise [px^2/frame^3]
+
+  // Constant velocity Kalman filter of one coordinate
+  struct kalman_1d {
+    float x, v;           // position and velocity per frame
+    float p00, p01, p11;  // covariance
+    void init(float z) {
+      x   = z;
+      v   = 0.0f;
+      p00 = MEASUREMENT_VAR;
+      p01 = 0.0f;
+      p11 = 100.0f;  // velocity unknown
+    }
+    void predict() {
+      x += v;
+      p00 += 2.0f * p01 + p11 + POSITION_VAR;
+      p01 += p11;
+      p11 += VELOCITY_VAR;
+    }
+    void correct(float z) {
+      const float s  = p00 + MEASUREMENT_VAR;
+      const float k0 = p00 / s, k1 = p01 / s;
+      const float y  = z - x;
+      x += k0 * y;
+      v += k1 * y;
+      p11 -= k1 * p01;
+      p01 -= k0 * p01;
+      p00 -= k0 * p00;
+    }
+  };
+
+  struct track {
+    bool active;
+    bool confirmed;
+    bool matched;  // in the current frame
+    bool is_new;
+    uint32_t id;
+    int32_t class_id;
+    float score;
+    int32_t hits;
+    int32_t misses;
+    int32_t coasted;  // frames since the last matched detection
+    kalman_1d cx, cy, w, h;
+    cv::Rect box() const {
+      const float bw = std::max(w.x, 1.0f), bh = std::max(h.x, 1.0f);
+      return cv::Rect(cvRound(cx.x - 0.5f * bw), cvRound(cy.x - 0.5f * bh), cvRound(bw), cvRound(bh));
+    }
+  };
+
+  struct candidate {
+    float iou;
+    uint16_t t, d;
+  };
+
+  float iou_threshold;
+  int32_t min_hits;
+  int32_t max_misses;
+  int32_t max_coast;
+  uint32_t next_id;
+  cv::Rect bounds;  // of the last frame
+  std::array<track, MAX_TRACKS> tracks;
+  std::array<candidate, MAX_TRACKS * MAX_DETECTIONS> candidates;
+  std::array<bool, MAX_DETECTIONS> used;
+  std::vector<tracked_object> objects;
+
+ public:
+  tracker(float iou = 0.3f, int32_t hits = 2, int32_t misses = 3, int32_t coast = 30)
+      : iou_threshold(iou),
+        min_hits(std::max(hits, 1)),
+        max_misses(std::max(misses, 1)),
+        max_coast(std::max(coast, 1)),
+        next_id(1) {
+    for (auto &t : tracks) {
+      t.active = false;
+    }
+    objects.reserve(MAX_TRACKS);
+  }
+
+  // Frame without detection: tracks move on by their velocity
+  const std::vector<tracked_object> &predict(const cv::Size &frame) {
+    bounds = cv::Rect(cv::Point(), frame);
+    for (auto &t : tracks) {
+      if (t.active) {
+        advance(t);
+      }
+    }
+    return report();
+  }
+
+  // Frame with detection (in frame coordinates)
+  const std::vector<tracked_object> &update(const std::vector<detection> &dets, const cv::Size &frame) {
+    const size_t num_dets = std::min(dets.size(), MAX_DETECTIONS);
+    bounds                = cv::Rect(cv::Point(), frame);
+    for (auto &t : tracks) {
+      if (t.active) {
+        advance(t);
+      }
+    }
+
+    // Candidate pairs above the IoU threshold, best first
+    size_t n = 0;
+    for (size_t i = 0; i < MAX_TRACKS; ++i) {
+      if (!tracks[i].active) {
+        continue;
+      }
+      const cv::Rect pb = tracks[i].box();
+      for (size_t j = 0; j < num_dets; ++j) {
+        if (dets[j].class_id != tracks[i].class_id) {
+          continue;
+        }
+        const float v = iou(pb, dets[j].box);
+        if (v >= iou_threshold) {
+          candidates[n++] = {v, static_cast<uint16_t>(i), static_cast<uint16_t>(j)};
+        }
+      }
+    }
+    std::sort(candidates.begin(), candidates.begin() + n,
+              [](const candidate &a, const candidate &b) { return a.iou > b.iou; });
+
+    std::fill(used.begin(), used.end(), false);
+    for (size_t k = 0; k < n; ++k) {
+      track &t = tracks[candidates[k].t];
+      if (t.matched || used[candidates[k].d]) {
+        continue;
+      }
+      const detection &d = dets[candidates[k].d];
+      used[candidates[k].d] = true;
+      t.matched             = true;
+      t.score               = d.score;
+      t.misses              = 0;
+      t.coasted             = 0;
+      t.cx.correct(d.box.x + 0.5f * d.box.width);
+      t.cy.correct(d.box.y + 0.5f * d.box.height);
+      t.w.correct(static_cast<float>(d.box.width));
+      t.h.correct(static_cast<float>(d.box.height));
+      if (++t.hits >= min_hits && !t.confirmed) {
+        t.confirmed = true;
+        t.is_new    = true;
+      }
+    }
+
+    // Unmatched tracks age, unmatched detections start new tracks
+    for (auto &t : tracks) {
+      if (t.active && !t.matched && ++t.misses > max_misses) {
+        t.active = false;
+      }
+    }
+    for (size_t j = 0; j < num_dets; ++j) {
+      if (!used[j]) {
+        start(dets[j]);
+      }
+    }
+    return report();
+  }
+
+  // Whether an object of the class was confirmed in the last frame
+  bool has_new(int32_t class_id) const {
+    for (const auto &o : objects) {
+      if (o.is_new && o.class_id == class_id) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const std::vector<tracked_object> &get_objects() const { return objects; }
+
+ private:
+  // Moves a track on by one frame; drops it once it has coasted too long or left the frame
+  void advance(track &t) {
+    t.cx.predict();
+    t.cy.predict();
+    t.w.predict();
+    t.h.predict();
+    t.matched = false;
+    t.is_new  = false;
+    if (++t.coasted > max_coast || (t.box() & bounds).empty()) {
+      t.active = false;
+    }
+  }
+
+  void start(const detection &d) {
+    for (auto &t : tracks) {
+      if (t.active) {
+        continue;
+      }
+      t.active    = true;
+      t.matched   = true;
+      t.id        = next_id++;
+      t.class_id  = d.class_id;
+      t.score     = d.score;
+      t.hits      = 1;
+      t.misses    = 0;
+      t.coasted   = 0;
+      t.confirmed = (min_hits <= 1);
+      t.is_new    = t.confirmed;
+      t.cx.init(d.box.x + 0.5f * d.box.width);
+      t.cy.init(d.box.y + 0.5f * d.box.height);
+      t.w.init(static_cast<float>(d.box.width));
+      t.h.init(static_cast<float>(d.box.height));
+      return;
+    }
+  }
+
+  const std::vector<tracked_object> &report() {
+    objects.clear();
+    for (const auto &t : tracks) {
+      if (t.active && t.confirmed) {
+        objects.push_back({t.id, t.class_id, t.score, t.box() & bounds, !t.matched, t.is_new});
+      }
+    }
+    return objects;
+  }
+
+  static float iou(const cv::Rect &a, const cv::Rect &b) {
+    const int32_t x0 = std::max(a.x, b.x), y0 = std::max(a.y, b.y);
+    const int32_t x1 = std::min(a.x + a.width, b.x + b.width);
+    const int32_t y1 = std::min(a.y + a.height, b.y + b.height);
+    if (x1 <= x0 || y1 <= y0) {
+      return 0.0f;
+    }
+    const float inter = static_cast<float>(x1 - x0) * static_cast<float>(y1 - y0);
+    return inter / (static_cast<float>(a.area()) + static_cast<float>(b.area()) - inter);
+  }
+};
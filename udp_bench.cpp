@@ -0,0 +1,94 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "simple_udp.hpp"
+
+/**************************************************************************************************
+  Loopback check and benchmark of the chunked UDP transport
+
+  A sender thread sends messages of a given size to a receiver on 127.0.0.1, optionally dropping
+  a fraction of the datagrams to exercise NACK retransmission, at a given frame rate (0: as fast
+  as possible). The receiver verifies the content of every message and reports throughput,
+  latency and losses.
+
+  usage: udp_bench [number of messages] [message size in bytes] [drop rate] [frames/s] [port]
+**************************************************************************************************/
+
+static uint8_t pattern(size_t msg, size_t k) { return static_cast<uint8_t>(msg * 131 + k * 7 + (k >> 11)); }
+
+int main(int argc, char *argv[]) {
+  const size_t num_messages = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 200;
+  const size_t size         = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1 << 20;
+  const double drop_rate    = (argc > 3) ? std::atof(argv[3]) : 0.0;
+  const double fps          = (argc > 4) ? std::atof(argv[4]) : 30.0;
+  const int port            = (argc > 5) ? std::atoi(argv[5]) : 40010;
+
+  using clock = std::chrono::steady_clock;
+  chunked_udp_receiver receiver("127.0.0.1", port, size);
+  chunked_udp_sender sender("127.0.0.1", port);
+  sender.set_drop_rate(drop_rate);
+
+  std::vector<clock::time_point> t_sent(num_messages);
+  std::atomic<bool> done(false);
+  std::thread th_send([&] {
+    std::vector<uint8_t> msg(size);
+    for (size_t i = 0; i < num_messages; ++i) {
+      for (size_t k = 0; k < size; ++k) {
+        msg[k] = pattern(i, k);
+      }
+      t_sent[i] = clock::now();
+      if (sender.send(msg.data(), msg.size()) < 0) {
+        break;
+      }
+      // Serve retransmission requests until the next frame is due
+      if (fps > 0.0) {
+        const auto t_next = t_sent[i] + std::chrono::microseconds(static_cast<int64_t>(1e6 / fps));
+        const auto wait   = std::chrono::duration_cast<std::chrono::milliseconds>(t_next - clock::now());
+        sender.serve_nacks(static_cast<int32_t>(std::max<int64_t>(wait.count(), 0)));
+      }
+    }
+    while (!done) {
+      sender.serve_nacks(10);
+    }
+  });
+
+  size_t received = 0, corrupted = 0;
+  double latency_sum = 0.0, latency_max = 0.0;
+  udp_message m;
+  const auto t0 = clock::now();
+  auto t_last   = t0;
+  while (received < num_messages && receiver.receive(m, 1000)) {
+    const auto now       = clock::now();
+    const double latency = std::chrono::duration<double, std::milli>(now - t_sent[m.id]).count();
+    latency_sum += latency;
+    latency_max = std::max(latency_max, latency);
+    t_last      = now;
+    bool ok     = (m.length == size);
+    for (size_t k = 0; ok && k < size; ++k) {
+      ok = (m.data[k] == pattern(m.id, k));
+    }
+    corrupted += !ok;
+    received++;
+  }
+  done = true;
+  th_send.join();
+
+  const udp_sender_stats ss   = sender.get_stats();
+  const udp_receiver_stats rs = receiver.get_stats();
+  const double seconds        = std::chrono::duration<double>(t_last - t0).count();
+  printf("messages: %zu of %zu received, %zu corrupted, %lu lost\n", received, num_messages, corrupted,
+         static_cast<unsigned long>(rs.lost));
+  printf("datagrams: %lu sent, %lu received, %lu duplicates; %lu NACKs, %lu chunks retransmitted\n",
+         static_cast<unsigned long>(ss.datagrams), static_cast<unsigned long>(rs.datagrams),
+         static_cast<unsigned long>(rs.duplicates), static_cast<unsigned long>(rs.nacks),
+         static_cast<unsigned long>(ss.retransmitted));
+  if (received > 0) {
+    printf("throughput: %.1f MB/s, delivery latency: %.3f ms on average, %.3f ms max\n",
+           received * size / seconds / (1 << 20), latency_sum / received, latency_max);
+  }
+  return (received == num_messages && corrupted == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "wire_protocol.hpp"
+
+/**************************************************************************************************
+  Round-trip check and benchmark of the codestream wire format
+
+  Encodes frames with random metadata, detections and payloads into one byte stream, feeds it to
+  wire_parser in random chunk sizes (as recv() would return them) and verifies every decoded
+  field. Reports the time per frame of header encoding and of parsing.
+
+  usage: wire_bench [number of frames] [payload size in bytes]
+**************************************************************************************************/
+
+static bool same_detection(const wire_detection &a, const wire_detection &b) {
+  // Scores are quantized to 16 bits
+  return a.class_id == b.class_id && std::abs(a.score - b.score) <= 1.0f / 65535.0f && a.x == b.x
+         && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+static bool same_info(const wire_frame_info &a, const wire_frame_info &b) {
+  if (a.seq != b.seq || a.timestamp_us != b.timestamp_us || a.camera_id != b.camera_id
+      || a.width != b.width || a.height != b.height || a.components != b.components || a.format != b.format
+      || a.qfactor != b.qfactor || a.levels != b.levels || a.block_size_log2 != b.block_size_log2
+      || a.detections.size() != b.detections.size() || a.is_crop != b.is_crop
+      || (a.is_crop
+          && (a.crop_x != b.crop_x || a.crop_y != b.crop_y || a.frame_width != b.frame_width
+              || a.frame_height != b.frame_height))) {
+    return false;
+  }
+  for (size_t i = 0; i < a.detections.size(); ++i) {
+    if (!same_detection(a.detections[i], b.detections[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t num_frames   = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 10000;
+  const size_t payload_size = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 65536;
+  if (num_frames == 0 || payload_size > WIRE_MAX_PAYLOAD_SIZE) {
+    printf("usage: %s [number of frames] [payload size in bytes (<= %u)]\n", argv[0],
+           WIRE_MAX_PAYLOAD_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int32_t> coord(-100, 4700);
+  std::uniform_int_distribution<int32_t> num_dets(0, 20);
+  std::uniform_real_distribution<float> score(0.0f, 1.0f);
+
+  // Frames to send; payloads vary in size so that frame boundaries fall anywhere in a chunk
+  std::vector<wire_frame_info> infos(num_frames);
+  std::vector<std::vector<uint8_t>> payloads(num_frames);
+  for (size_t i = 0; i < num_frames; ++i) {
+    wire_frame_info &info = infos[i];
+    info.seq              = i;
+    info.timestamp_us     = 1700000000000000ull + i * 33333;
+    info.camera_id        = static_cast<uint16_t>(i % 4);
+    info.width            = 4608;
+    info.height           = 3456;
+    info.format           = (i & 1) ? wire_pixel_format::ycbcr420 : wire_pixel_format::rgb;
+    info.qfactor          = 85;
+    info.levels           = 5;
+    info.block_size_log2  = 6;
+    if (i % 3 == 0) {
+      // Crop of a detection
+      info.is_crop      = true;
+      info.crop_x       = static_cast<uint16_t>(coord(rng) & 0xFFF);
+      info.crop_y       = static_cast<uint16_t>(coord(rng) & 0xFFF);
+      info.frame_width  = 4608;
+      info.frame_height = 3456;
+    }
+    for (int32_t n = num_dets(rng); n > 0; --n) {
+      info.detections.push_back({static_cast<uint16_t>(n % 80), score(rng), coord(rng), coord(rng),
+                                 coord(rng) & 0x7FF, coord(rng) & 0x7FF});
+    }
+    payloads[i].resize(payload_size - (payload_size ? rng() % (payload_size / 8 + 1) : 0));
+    for (auto &b : payloads[i]) {
+      b = static_cast<uint8_t>(rng());
+    }
+  }
+
+  // Encode headers (the payload is not copied by the sender: it goes out with writev())
+  std::vector<uint8_t> header;
+  size_t header_bytes = 0;
+  auto t0             = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < num_frames; ++i) {
+    wire_encode_header(infos[i], static_cast<uint32_t>(payloads[i].size()), header);
+    header_bytes += header.size();
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  std::vector<uint8_t> stream;
+  stream.reserve(header_bytes + num_frames * payload_size);
+  for (size_t i = 0; i < num_frames; ++i) {
+    wire_encode_header(infos[i], static_cast<uint32_t>(payloads[i].size()), header);
+    stream.insert(stream.end(), header.begin(), header.end());
+    stream.insert(stream.end(), payloads[i].begin(), payloads[i].end());
+  }
+
+  // Parse in random chunks of up to 64 kB
+  std::uniform_int_distribution<size_t> chunk(1, 65536);
+  std::vector<size_t> chunks;
+  for (size_t pos = 0; pos < stream.size();) {
+    const size_t n = std::min(chunk(rng), stream.size() - pos);
+    chunks.push_back(n);
+    pos += n;
+  }
+  wire_parser parser;
+  wire_frame_info info;
+  std::vector<uint8_t> payload;
+  size_t received = 0, pos = 0, errors = 0;
+  auto t2 = std::chrono::high_resolution_clock::now();
+  for (const size_t n : chunks) {
+    parser.feed(stream.data() + pos, n);
+    pos += n;
+    wire_status st;
+    while ((st = parser.next(info, payload)) == wire_status::ok) {
+      if (received >= num_frames || !same_info(info, infos[received]) || payload != payloads[received]) {
+        ++errors;
+      }
+      ++received;
+    }
+    if (st != wire_status::need_more) {
+      printf("ERROR: parser failed with status %d after %zu frames\n", static_cast<int>(st), received);
+      return EXIT_FAILURE;
+    }
+  }
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  // A corrupted magic has to be detected
+  stream[0] ^= 0xFF;
+  wire_parser bad;
+  bad.feed(stream.data(), std::min<size_t>(stream.size(), 64));
+  const bool detects_corruption = (bad.next(info, payload) == wire_status::bad_magic);
+
+  const double t_enc = std::chrono::duration<double, std::micro>(t1 - t0).count();
+  const double t_dec = std::chrono::duration<double, std::micro>(t3 - t2).count();
+  const double mb    = static_cast<double>(stream.size()) / (1 << 20);
+  printf("frames: %zu, stream: %.1f MB in %zu chunks\n", num_frames, mb, chunks.size());
+  printf("header: %8.3f us/frame (%.1f bytes on average)\n", t_enc / num_frames,
+         static_cast<double>(header_bytes) / num_frames);
+  printf("parse : %8.3f us/frame (%7.1f MB/s)\n", t_dec / num_frames, mb / t_dec * 1e6);
+  if (received != num_frames || errors != 0 || parser.pending() != 0 || !detects_corruption) {
+    printf("ERROR: round trip failed: %zu of %zu frames received, %zu mismatches, %zu bytes left%s\n",
+           received, num_frames, errors, parser.pending(),
+           detects_corruption ? "" : ", corruption not detected");
+    return EXIT_FAILURE;
+  }
+  printf("round trip OK\n");
+  return EXIT_SUCCESS;
+}
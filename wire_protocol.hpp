@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**************************************************************************************************
+  Wire format of codestream transport (version 1)
+
+  Every frame is a header followed by the codestream. All integers are big-endian.
+
+  offset size  field
+       0    4  magic "HJ2K"
+       4    1  version
+       5    1  pixel format of the codestream (0: RGB, 1: YCbCr 4:2:0)
+       6    2  header length in bytes, including detections
+       8    4  payload (codestream) length in bytes
+      12    8  sequence number
+      20    8  capture time [us since the Unix epoch]
+      28    2  camera id
+      30    2  width
+      32    2  height
+      34    1  number of components
+      35    1  Qfactor
+      36    1  number of DWT levels
+      37    1  log2 of the code-block size
+      38    2  number of detections
+      40   12  detection: class id (2), score * 65535 (2), x, y, width, height (2 each, signed)
+               ... repeated
+               extensions: type (1), length of the value (1), value ... repeated
+
+  Extensions
+    type 1 (crop), 8 bytes: x, y of the crop in the frame, width, height of the frame (2 each).
+                  The codestream is a crop of width x height at (x, y); detections stay in frame
+                  coordinates.
+
+  Receivers skip header bytes beyond the fields they know and extensions of unknown types, so
+  later versions can append fields without breaking older receivers; the version only changes
+  for incompatible layouts.
+**************************************************************************************************/
+constexpr uint8_t WIRE_MAGIC[4]          = {'H', 'J', '2', 'K'};
+constexpr uint8_t WIRE_VERSION           = 1;
+constexpr size_t WIRE_FIXED_SIZE         = 40;
+constexpr size_t WIRE_DETECTION_SIZE     = 12;
+constexpr uint8_t WIRE_EXT_CROP          = 1;
+constexpr size_t WIRE_EXT_CROP_SIZE      = 2 + 8;
+constexpr size_t WIRE_MAX_EXTENSIONS     = 64;  // bytes reserved for extensions
+constexpr uint32_t WIRE_MAX_PAYLOAD_SIZE = 64u << 20;
+constexpr size_t WIRE_MAX_DETECTIONS =
+    (0xFFFF - WIRE_FIXED_SIZE - WIRE_MAX_EXTENSIONS) / WIRE_DETECTION_SIZE;
+
+enum class wire_pixel_format : uint8_t { rgb = 0, ycbcr420 = 1 };
+
+struct wire_detection {
+  uint16_t class_id;
+  float score;
+  int32_t x, y, width, height;  // box in frame coordinates
+};
+
+struct wire_frame_info {
+  uint64_t seq;
+  uint64_t timestamp_us;
+  uint16_t camera_id;
+  uint16_t width;
+  uint16_t height;
+  uint8_t components;
+  wire_pixel_format format;
+  uint8_t qfactor;
+  uint8_t levels;
+  uint8_t block_size_log2;
+  std::vector<wire_detection> detections;
+  bool is_crop;  // crop extension
+  uint16_t crop_x, crop_y, frame_width, frame_height;
+
+  wire_frame_info()
+      : seq(0),
+        timestamp_us(0),
+        camera_id(0),
+        width(0),
+        height(0),
+        components(3),
+        format(wire_pixel_format::rgb),
+        qfactor(0),
+        levels(0),
+        block_size_log2(0),
+        is_crop(false),
+        crop_x(0),
+        crop_y(0),
+        frame_width(0),
+        frame_height(0) {}
+};
+
+namespace wire_detail {
+inline void put16(uint8_t *p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v >> 8);
+  p[1] = static_cast<uint8_t>(v);
+}
+inline void put32(uint8_t *p, uint32_t v) {
+  put16(p, static_cast<uint16_t>(v >> 16));
+  put16(p + 2, static_cast<uint16_t>(v));
+}
+inline void put64(uint8_t *p, uint64_t v) {
+  put32(p, static_cast<uint32_t>(v >> 32));
+  put32(p + 4, static_cast<uint32_t>(v));
+}
+inline uint16_t get16(const uint8_t *p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+inline uint32_t get32(const uint8_t *p) { return (static_cast<uint32_t>(get16(p)) << 16) | get16(p + 2); }
+inline uint64_t get64(const uint8_t *p) { return (static_cast<uint64_t>(get32(p)) << 32) | get32(p + 4); }
+inline int16_t clamp16(int32_t v) { return static_cast<int16_t>(std::min(std::max(v, -32768), 32767)); }
+}  // namespace wire_detail
+
+// Serialize the header of a frame into out (resized); detections beyond the limit are dropped
+inline void wire_encode_header(const wire_frame_info &info, uint32_t payload_length,
+                               std::vector<uint8_t> &out) {
+  using namespace wire_detail;
+  const size_t num_dets = std::min(info.detections.size(), WIRE_MAX_DETECTIONS);
+  const size_t length =
+      WIRE_FIXED_SIZE + num_dets * WIRE_DETECTION_SIZE + (info.is_crop ? WIRE_EXT_CROP_SIZE : 0);
+  out.resize(length);
+  uint8_t *p = out.data();
+  std::memcpy(p, WIRE_MAGIC, 4);
+  p[4] = WIRE_VERSION;
+  p[5] = static_cast<uint8_t>(info.format);
+  put16(p + 6, static_cast<uint16_t>(length));
+  put32(p + 8, payload_length);
+  put64(p + 12, info.seq);
+  put64(p + 20, info.timestamp_us);
+  put16(p + 28, info.camera_id);
+  put16(p + 30, info.width);
+  put16(p + 32, info.height);
+  p[34] = info.components;
+  p[35] = info.qfactor;
+  p[36] = info.levels;
+  p[37] = info.block_size_log2;
+  put16(p + 38, static_cast<uint16_t>(num_dets));
+  p += WIRE_FIXED_SIZE;
+  for (size_t i = 0; i < num_dets; ++i, p += WIRE_DETECTION_SIZE) {
+    const wire_detection &d = info.detections[i];
+    const float score       = std::min(std::max(d.score, 0.0f), 1.0f);
+    put16(p, d.class_id);
+    put16(p + 2, static_cast<uint16_t>(std::lround(score * 65535.0f)));
+    put16(p + 4, static_cast<uint16_t>(clamp16(d.x)));
+    put16(p + 6, static_cast<uint16_t>(clamp16(d.y)));
+    put16(p + 8, static_cast<uint16_t>(clamp16(d.width)));
+    put16(p + 10, static_cast<uint16_t>(clamp16(d.height)));
+  }
+  if (info.is_crop) {
+    p[0] = WIRE_EXT_CROP;
+    p[1] = static_cast<uint8_t>(WIRE_EXT_CROP_SIZE - 2);
+    put16(p + 2, info.crop_x);
+    put16(p + 4, info.crop_y);
+    put16(p + 6, info.frame_width);
+    put16(p + 8, info.frame_height);
+  }
+}
+
+enum class wire_status {
+  ok,
+  need_more,    // header incomplete
+  bad_magic,    // not a frame boundary: the stream is out of sync
+  bad_version,  // incompatible layout
+  bad_length    // inconsistent or oversized lengths
+};
+
+// Parse a header from the first len bytes of data
+inline wire_status wire_decode_header(const uint8_t *data, size_t len, wire_frame_info &info,
+                                      size_t &header_length, uint32_t &payload_length) {
+  using namespace wire_detail;
+  if (len < 8) {
+    return (std::memcmp(data, WIRE_MAGIC, std::min<size_t>(len, 4)) == 0) ? wire_status::need_more
+                                                                          : wire_status::bad_magic;
+  }
+  if (std::memcmp(data, WIRE_MAGIC, 4) != 0) {
+    return wire_status::bad_magic;
+  }
+  if (data[4] != WIRE_VERSION) {
+    return wire_status::bad_version;
+  }
+  header_length = get16(data + 6);
+  if (header_length < WIRE_FIXED_SIZE) {
+    return wire_status::bad_length;
+  }
+  if (len < header_length) {
+    return wire_status::need_more;
+  }
+  payload_length = get32(data + 8);
+  if (payload_length > WIRE_MAX_PAYLOAD_SIZE) {
+    return wire_status::bad_length;
+  }
+  const size_t num_dets = get16(data + 38);
+  if (WIRE_FIXED_SIZE + num_dets * WIRE_DETECTION_SIZE > header_length) {
+    return wire_status::bad_length;
+  }
+  info.format          = static_cast<wire_pixel_format>(data[5]);
+  info.seq             = get64(data + 12);
+  info.timestamp_us    = get64(data + 20);
+  info.camera_id       = get16(data + 28);
+  info.width           = get16(data + 30);
+  info.height          = get16(data + 32);
+  info.components      = data[34];
+  info.qfactor         = data[35];
+  info.levels          = data[36];
+  info.block_size_log2 = data[37];
+  info.detections.resize(num_dets);
+  const uint8_t *p = data + WIRE_FIXED_SIZE;
+  for (size_t i = 0; i < num_dets; ++i, p += WIRE_DETECTION_SIZE) {
+    wire_detection &d = info.detections[i];
+    d.class_id        = get16(p);
+    d.score           = get16(p + 2) / 65535.0f;
+    d.x               = static_cast<int16_t>(get16(p + 4));
+    d.y               = static_cast<int16_t>(get16(p + 6));
+    d.width           = static_cast<int16_t>(get16(p + 8));
+    d.height          = static_cast<int16_t>(get16(p + 10));
+  }
+  info.is_crop       = false;
+  const uint8_t *end = data + header_length;
+  while (end - p >= 2 && end - p >= 2 + p[1]) {
+    if (p[0] == WIRE_EXT_CROP && p[1] >= 8) {
+      info.is_crop      = true;
+      info.crop_x       = get16(p + 2);
+      info.crop_y       = get16(p + 4);
+      info.frame_width  = get16(p + 6);
+      info.frame_height = get16(p + 8);
+    }
+    p += 2 + p[1];
+  }
+  return wire_status::ok;
+}
+
+/**************************************************************************************************
+  Incremental parser of a byte stream carrying frames
+
+  Bytes are fed as they arrive (in any chunking) and complete frames are popped with next().
+  The internal buffer is compacted lazily, so a frame costs one copy in and one copy out.
+**************************************************************************************************/
+class wire_parser {
+ private:
+  std::vector<uint8_t> buf;
+  size_t rpos;
+  bool failed;
+
+ public:
+  wire_parser() : rpos(0), failed(false) {}
+
+  // Append received bytes
+  void feed(const uint8_t *data, size_t len) {
+    if (rpos > 0 && rpos >= buf.size() / 2) {
+      buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(rpos));
+      rpos = 0;
+    }
+    buf.insert(buf.end(), data, data + len);
+  }
+
+  // Pop the next complete frame. Returns need_more until one is complete; any other status than
+  // ok and need_more means the stream is corrupted and the connection should be dropped.
+  wire_status next(wire_frame_info &info, std::vector<uint8_t> &payload) {
+    if (failed) {
+      return wire_status::bad_magic;
+    }
+    size_t header_length    = 0;
+    uint32_t payload_length = 0;
+    const wire_status st =
+        wire_decode_header(buf.data() + rpos, buf.size() - rpos, info, header_length, payload_length);
+    if (st != wire_status::ok) {
+      failed = (st != wire_status::need_more);
+      return st;
+    }
+    if (buf.size() - rpos < header_length + payload_length) {
+      return wire_status::need_more;
+    }
+    const uint8_t *p = buf.data() + rpos + header_length;
+    payload.assign(p, p + payload_length);
+    rpos += header_length + payload_length;
+    return wire_status::ok;
+  }
+
+  // Bytes received but not yet returned as frames
+  size_t pending() const { return buf.size() - rpos; }
+};
@@ -7,6 +7,11 @@
 #include <opencv2/core/mat.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/dnn/dnn.hpp>
+#include "inference_engine.hpp"
+#include "yolo_decoder.hpp"
+#include "yolo_nms.hpp"
+#include "yolo_preprocess.hpp"
+#include "yolo_tiles.hpp"
 
 // Text parameters
 constexpr float FONT_SCALE  = 0.5f;
@@ -20,6 +25,13 @@ cv::Scalar YELLOW = cv::Scalar(0, 255, 255);
 cv::Scalar RED    = cv::Scalar(0, 0, 255);
 cv::Scalar WHITE  = cv::Scalar(255, 255, 255);
 
+// Result of detection in frame coordinates
+struct detection {
+  int32_t class_id;
+  float score;
+  cv::Rect box;
+};
+
 class yolo_class {
  private:
   const float model_width;
@@ -27,11 +39,30 @@ class yolo_class {
   const float score_threshold;
   const float nms_threshold;
   const float confidence_threshold;
-  const int32_t rows;
+  int32_t rows;        // number of candidate rows in the output tensor
+  int32_t dimensions;  // length of a row: 5 + number of classes
   int32_t af_trigger;
   std::vector<std::string> class_list;
   std::vector<cv::Mat> detections;
-  cv::dnn::Net net;
+  std::unique_ptr<inference_engine> engine;
+  // Persistent input blob
+  letterbox_blob preproc;
+  // Reusable post-process buffers
+  yolo_decoder decoder;
+  std::vector<detection> candidates;  // before NMS, in frame coordinates
+  yolo_nms nms;
+  std::vector<detection> results;
+  // Batched inference of the tiles of a frame, or of the frames of several sources
+  std::unique_ptr<tile_scheduler> tiler;
+  std::vector<letterbox_blob> batch_preproc;            // interpolation tables of each tile or source
+  std::vector<std::vector<detection>> tile_candidates;  // kept for the tiles not detected again
+  std::vector<size_t> batch_tiles;                      // tiles in the batch of the current frame
+  std::vector<std::vector<detection>> batch_results;    // of each frame given to detect_batch()
+  cv::Mat batch_blob;                                   // N x 3 x H x W
+  bool batch_forward;                                   // the model accepts N > 1
+  bool full_batch;                                      // ... but only N
+  bool batched;                                         // the last call ran on the batch blob
+  double t_batch;
   bool is_set;
 
  public:
@@ -41,13 +72,14 @@ class yolo_class {
         score_threshold(th_sc),
         nms_threshold(th_nms),
         confidence_threshold(th_conf),
-        // 25200 for default size 640x640
-        // 6300 for size 320x320
-        // 1575 for size 160x160
-        rows((static_cast<int32_t>(model_width) == 160)   ? 1575
-             : (static_cast<int32_t>(model_width) == 320) ? 6300
-             : (static_cast<int32_t>(model_width) == 640) ? 25200
-                                                          : -1),
+        rows(0),
+        dimensions(0),
+        af_trigger(0),
+        nms(th_nms),
+        batch_forward(false),
+        full_batch(false),
+        batched(false),
+        t_batch(0.0),
         is_set(false){};
 
   ~yolo_class() {
@@ -59,9 +91,14 @@ class yolo_class {
     }
   }
 
-  void init(const char *fname_class_list, const char *onnx_file) {
-    if ((this->rows < 0) || (model_width != model_height)) {
-      printf("ERROR: unsupported model size %4.0f x %4.0f\n", model_width, model_height);
+  void init(const char *fname_class_list, const char *onnx_file,
+            const engine_options &options = engine_options()) {
+    // Any size aligned to the largest stride (32) of YOLOv5 is acceptable
+    const int32_t iw = static_cast<int32_t>(model_width);
+    const int32_t ih = static_cast<int32_t>(model_height);
+    if (iw <= 0 || ih <= 0 || (iw % 32) || (ih % 32)) {
+      printf("ERROR: unsupported model size %4.0f x %4.0f (shall be multiples of 32)\n", model_width,
+             model_height);
       throw std::exception();
     }
     // Load class list
@@ -72,141 +109,334 @@ class yolo_class {
     }
     std::string line;
     while (getline(ifs, line)) {
-      this->class_list.push_back(line);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!line.empty()) {
+        this->class_list.push_back(line);
+      }
     }
 
     // Load model
+    this->engine = create_inference_engine(options);
+    this->engine->load(onnx_file);
+
+    // Allocate input blob once
+    this->preproc.create(iw, ih, true);
+
+    // Get the shape of the output tensor by a warm-up inference
+    // 1 x rows x (5 + number of classes), e.g. rows = 25200 for 640x640, 6300 for 320x320
+    this->preproc.get_blob().setTo(cv::Scalar::all(0.0));
+    this->detections.resize(1);
     try {
-      this->net = cv::dnn::readNet(onnx_file);
+      this->detections[0] = this->engine->forward(this->preproc.get_blob());
     } catch (std::exception &exc) {
-      printf("ERROR: could not find %s!\n", onnx_file);
+      printf("ERROR: %s does not accept input of size %d x %d\n", onnx_file, iw, ih);
       throw std::exception();
     }
-    // Set Preferable Backend and Target (currently does not have any effect)
-    this->net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
-    this->net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    const cv::Mat &out = this->detections[0];
+    this->rows         = (out.dims == 3) ? out.size[1] : out.size[0];
+    this->dimensions   = (out.dims == 3) ? out.size[2] : out.size[1];
+    if (this->dimensions != static_cast<int32_t>(this->class_list.size()) + 5) {
+      printf("ERROR: %s outputs %d values per row, but %s has %zu classes\n", onnx_file, this->dimensions,
+             fname_class_list, this->class_list.size());
+      throw std::exception();
+    }
+
+    // Allocate post-process buffers once
+    this->decoder.reserve(this->rows);
+    reserve_candidates(this->rows);
 
     this->is_set = true;
   }
 
+  // Tiled detection of large frames: cols x tile_rows tiles overlapping by `overlap`, each letterboxed to
+  // the model size (see tile_scheduler). With `sad` > 0, tiles whose content did not change keep their
+  // detections. Tiles are detected in one forward pass if the model accepts a batch, else one by one.
+  // Call after init(); cols or tile_rows <= 0 detects whole frames again.
+  void set_tiling(int32_t cols, int32_t tile_rows, float overlap = 0.2f, float sad = 0.0f) {
+    if (!this->is_set) {
+      printf("ERROR: tiling has to be set after init()\n");
+      throw std::exception();
+    }
+    if (cols <= 0 || tile_rows <= 0) {
+      this->tiler.reset();
+      return;
+    }
+    this->tiler.reset(new tile_scheduler(cols, tile_rows, overlap, sad));
+    const int32_t n = static_cast<int32_t>(this->tiler->size());
+    this->tile_candidates.resize(n);
+    for (auto &c : this->tile_candidates) {
+      c.clear();
+      c.reserve(this->rows);
+    }
+    this->batch_tiles.reserve(n);
+    // Batches are partial when unchanged tiles are skipped
+    allocate_batch(n, sad > 0.0f);
+  }
+
+  // Batched detection of frames of several sources by detect_batch(), up to n per forward pass (fewer
+  // if the model takes a fixed batch of 1). Call after init(); replaces tiling.
+  void set_batch_size(int32_t n) {
+    if (!this->is_set) {
+      printf("ERROR: the batch size has to be set after init()\n");
+      throw std::exception();
+    }
+    this->tiler.reset();
+    this->batch_results.resize(std::max(n, 1));
+    for (auto &r : this->batch_results) {
+      r.reserve(this->rows);
+    }
+    allocate_batch(std::max(n, 1), true);
+  }
+
+  int32_t get_batch_size() const { return static_cast<int32_t>(this->batch_preproc.size()); }
+
+  int32_t get_num_tiles() const { return this->tiler ? static_cast<int32_t>(this->tiler->size()) : 0; }
+
+  // Tiles detected in the last frame (all of them unless unchanged tiles are skipped)
+  int32_t get_num_detected_tiles() const { return static_cast<int32_t>(this->batch_tiles.size()); }
+
   int32_t get_aftrigger() { return this->af_trigger; }
 
   bool is_empty() { return this->is_set; }
 
-  inline cv::Mat invoke(cv::Mat &input_image) {
+  int32_t get_num_rows() const { return this->rows; }
+
+  int32_t get_num_classes() const { return this->dimensions - 5; }
+
+  // Detect objects without touching the input image. The returned vector is valid until the next call.
+  inline const std::vector<detection> &detect(const cv::Mat &input_image,
+                                              pixel_format format = pixel_format::bgr) {
+    this->batched = (this->tiler != nullptr);
+    if (this->tiler) {
+      return detect_tiles(input_image, format);
+    }
     /****************************************************************************************************
       Pre-process
     ****************************************************************************************************/
-    // Convert to blob
-    cv::Mat blob;
-    cv::dnn::blobFromImage(input_image, blob, 1. / 255., cv::Size(model_width, model_height), cv::Scalar(),
-                           true, false);
-    this->net.setInput(blob);
+    // Letterbox into the persistent blob
+    const letterbox_info &lb = this->preproc.run(input_image, format);
     // Forward propagate
-    net.forward(this->detections, getOutputsNames(net)[0]);
-    // printf("output size = %d\n", outputs[0].size().area());
+    this->detections[0] = this->engine->forward(this->preproc.get_blob());
 
     /****************************************************************************************************
      Post-process
     ****************************************************************************************************/
-    cv::Mat output_image = input_image.clone();
-    std::vector<int32_t> class_ids;
-    std::vector<float> confidences;
-    std::vector<cv::Rect> boxes;
-
-    // Resizing factors
-    float x_scale  = output_image.cols / model_width;
-    float y_factor = output_image.rows / model_height;
-
-    // this number shall be +5 of row number of class list
-    const int32_t dimensions = 85;
-    // singe row of data_origin consists of;
-    // | 0 | 1 | 2 | 3 |      4     | 5 ...                    84|
-    // | X | Y | W | H | Confidence | Class scores of 80 clasees |
-    float *data_origin = reinterpret_cast<float *>(this->detections[0].data);
-    float *p           = data_origin;
-
-    // Iterate through this->row detections
-    for (int32_t i = 0; i < this->rows; ++i) {
-      float confidence = p[4];
-      // Discard bad detections and continue.
-      if (confidence >= confidence_threshold) {
-        float *classes_scores = p + 5;
-        // Create a 1x85 cv::Mat and store class scores of 80 classes
-        cv::Mat scores(1, this->class_list.size(), CV_32FC1, classes_scores);
-        // Perform minMaxLoc and acquire the index of best class  score
-        cv::Point class_id;
-        double max_class_score;
-        minMaxLoc(scores, 0, &max_class_score, 0, &class_id);
-        // Continue if the class score is above the threshold
-        if (max_class_score > score_threshold) {
-          // Store class ID and confidence in the pre-defined respective vectors
-          confidences.push_back(confidence);
-          class_ids.push_back(class_id.x);
-          // Center
-          float cx = p[0];
-          float cy = p[1];
-          // Box dimension
-          float w = p[2];
-          float h = p[3];
-          // Bounding box coordinates
-          int32_t left   = int32_t((cx - 0.5f * w) * x_scale);
-          int32_t top    = int32_t((cy - 0.5f * h) * y_factor);
-          int32_t width  = int32_t(w * x_scale);
-          int32_t height = int32_t(h * y_factor);
-          // Store good detections in the boxes vector
-          boxes.push_back(cv::Rect(left, top, width, height));
-        }
-      }
-      // Jump to the next row
-      p = data_origin + i * dimensions;
-    }
+    candidates.clear();
+    decode_candidates(reinterpret_cast<const float *>(this->detections[0].data), lb, cv::Point(0, 0),
+                      candidates);
+    return suppress(candidates);
+  }
 
-    // Perform Non-Maximum Suppression and draw predictions
-    std::vector<int32_t> indices;
-    bool is_person = false;
-    cv::dnn::NMSBoxes(boxes, confidences, score_threshold, nms_threshold, indices);
-    for (size_t i = 0; i < indices.size(); i++) {
-      int32_t idx    = indices[i];
-      cv::Rect box   = boxes[idx];
-      int32_t left   = box.x;
-      int32_t top    = box.y;
-      int32_t width  = box.width;
-      int32_t height = box.height;
+  // Draw bounding boxes and labels of detections onto an image
+  void draw(cv::Mat &image, const std::vector<detection> &dets) const {
+    for (const auto &d : dets) {
+      const cv::Rect &box = d.box;
       // Draw bounding box
-      cv::rectangle(output_image, cv::Point(left, top), cv::Point(left + width, top + height), BLUE,
+      cv::rectangle(image, cv::Point(box.x, box.y), cv::Point(box.x + box.width, box.y + box.height), BLUE,
                     3 * THICKNESS);
       // Get the label for the class name and its confidence
-      std::string label = cv::format("%.2f", confidences[idx]);
-      label             = this->class_list[class_ids[idx]] + ":" + label;
-      if (class_ids[idx] == 0) {
+      std::string label = cv::format("%.2f", d.score);
+      label             = this->class_list[d.class_id] + ":" + label;
+      // Draw class labels
+      draw_label(image, label, box.x, box.y);
+    }
+  }
+
+  // Detect objects and return an annotated copy of the input image
+  inline cv::Mat invoke(cv::Mat &input_image) {
+    const std::vector<detection> &dets = detect(input_image);
+    cv::Mat output_image               = input_image.clone();
+    draw(output_image, dets);
+    return output_image;
+  }
+
+  const std::vector<std::string> &get_class_list() const { return this->class_list; }
+
+  std::vector<cv::Mat> &get_detection() { return this->detections; }
+
+  const letterbox_info &get_letterbox() const { return this->preproc.get_info(); }
+
+  inference_engine &get_engine() { return *this->engine; }
+
+  // Detect objects in frames of several sources (up to the batch size) with as few forward passes as
+  // the model allows. Returns the detections of each frame, valid until the next call; get_aftrigger()
+  // tells whether any of the frames has a person.
+  const std::vector<std::vector<detection>> &detect_batch(const std::vector<cv::Mat> &frames,
+                                                          const std::vector<pixel_format> &formats) {
+    if (frames.size() > this->batch_preproc.size() || formats.size() != frames.size() || this->tiler) {
+      printf("ERROR: %zu frames for a batch of %zu\n", frames.size(), this->batch_preproc.size());
+      throw std::exception();
+    }
+    this->batched = true;
+    const size_t image = batch_image_size();
+    float *base        = reinterpret_cast<float *>(this->batch_blob.data);
+    cv::parallel_for_(cv::Range(0, static_cast<int32_t>(frames.size())), [&](const cv::Range &r) {
+      for (int32_t k = r.start; k < r.end; ++k) {
+        this->batch_preproc[k].bind(base + k * image);
+        this->batch_preproc[k].run(frames[k], formats[k]);
+      }
+    });
+    bool is_person = false;
+    forward_batch(frames.size(), [&](size_t k, const float *output) {
+      candidates.clear();
+      decode_candidates(output, this->batch_preproc[k].get_info(), cv::Point(0, 0), candidates);
+      this->batch_results[k] = suppress(candidates);
+      is_person              = is_person || this->af_trigger;
+    });
+    this->af_trigger = is_person ? 1 : 0;
+    return this->batch_results;
+  }
+
+  // Time spent by the network on the last call [ms]; the sum of its forward passes if batched
+  double get_inference_time() { return this->batched ? this->t_batch : this->engine->get_inference_time(); }
+
+ private:
+  void reserve_candidates(size_t n) {
+    this->candidates.reserve(n);
+    this->nms.reserve(n);
+    this->results.reserve(n);
+  }
+
+  // Candidates of one output image, mapped back to the frame; `origin` is that of the letterboxed region
+  void decode_candidates(const float *output, const letterbox_info &lb, const cv::Point &origin,
+                         std::vector<detection> &dst) {
+    // Factors to map model coordinates back to the frame
+    const float inv_scale = 1.0f / lb.scale;
+
+    const size_t num_candidates =
+        this->decoder.decode(output, this->rows, this->dimensions, confidence_threshold, score_threshold);
+    for (size_t i = 0; i < num_candidates; ++i) {
+      // Bounding box coordinates
+      int32_t left   = int32_t((decoder.cx[i] - 0.5f * decoder.w[i] - lb.pad_x) * inv_scale);
+      int32_t top    = int32_t((decoder.cy[i] - 0.5f * decoder.h[i] - lb.pad_y) * inv_scale);
+      int32_t width  = int32_t(decoder.w[i] * inv_scale);
+      int32_t height = int32_t(decoder.h[i] * inv_scale);
+      // Store good detections with their class ID and confidence
+      dst.push_back({decoder.class_id[i], decoder.confidence[i],
+                     cv::Rect(origin.x + left, origin.y + top, width, height)});
+    }
+  }
+
+  // Non-Maximum Suppression over all candidates (of all tiles), class by class
+  const std::vector<detection> &suppress(const std::vector<detection> &cands) {
+    nms.clear();
+    for (const auto &c : cands) {
+      nms.push(c.box.x, c.box.y, c.box.width, c.box.height, c.score, c.class_id);
+    }
+    bool is_person = false;
+    const std::vector<int32_t> &kept = nms.run(score_threshold);
+    results.clear();
+    for (size_t i = 0; i < kept.size(); i++) {
+      const detection &c = cands[kept[i]];
+      results.push_back(c);
+      if (c.class_id == 0) {
         is_person = true;
       }
-      // Draw class labels
-      draw_label(output_image, label, left, top);
     }
     if (is_person) {
       this->af_trigger = 1;
     } else {
       this->af_trigger = 0;
     }
-    return output_image;
+    return results;
   }
 
-  std::vector<cv::Mat> &get_detection() { return this->detections; }
+  size_t batch_image_size() const {
+    return static_cast<size_t>(3) * static_cast<size_t>(model_width) * static_cast<size_t>(model_height);
+  }
+
+  // Blob and letterbox tables of n images; `partial` when batches may hold fewer images
+  void allocate_batch(int32_t n, bool partial) {
+    const int32_t iw = static_cast<int32_t>(model_width);
+    const int32_t ih = static_cast<int32_t>(model_height);
+    const int sz[]   = {n, 3, ih, iw};
+    this->batch_blob.create(4, sz, CV_32F);
+    this->batch_preproc.resize(n);
+    for (auto &lb : this->batch_preproc) {
+      lb.create(iw, ih);
+    }
+    reserve_candidates(static_cast<size_t>(this->rows) * n);
 
-  cv::dnn::Net &get_net() { return this->net; }
+    // Probe whether the model takes a batch of n (exported with a dynamic batch or one of n), and of less
+    this->batch_forward = (n > 1) && probe_batch(n);
+    this->full_batch    = this->batch_forward && partial && !probe_batch(n - 1);
+    if (n > 1 && !this->batch_forward) {
+      printf("WARNING: the model takes one image per forward pass, batches are detected one by one\n");
+    }
+  }
 
-  double get_inference_time() {
-    // The function getPerfProfile returns the overall time for inference(t)
-    // and the timings for each of the layers(in layersTimes)
-    std::vector<double> layersTimes;
-    double freq = cv::getTickFrequency() / 1000;
-    return this->net.getPerfProfile(layersTimes) / freq;
+  bool probe_batch(int32_t n) {
+    const int sz[] = {n, 3, static_cast<int32_t>(model_height), static_cast<int32_t>(model_width)};
+    this->batch_blob.setTo(cv::Scalar::all(0.0));
+    try {
+      const cv::Mat &out = this->engine->forward(cv::Mat(4, sz, CV_32F, this->batch_blob.data));
+      return out.dims == 3 && out.size[0] == n && out.size[1] == this->rows;
+    } catch (std::exception &exc) {
+      return false;
+    }
   }
 
- private:
-  inline void draw_label(cv::Mat &input_image, std::string label, int32_t left, int32_t top) {
+  // Forward passes of the first `count` images of the batch blob: one pass if the model takes a batch
+  // (of all images of the blob if its batch size is fixed), or one per image. `decode(k, output)` is
+  // called with the output of each of the `count` images.
+  template <class Decoder>
+  void forward_batch(size_t count, Decoder &&decode) {
+    const int32_t iw   = static_cast<int32_t>(model_width);
+    const int32_t ih   = static_cast<int32_t>(model_height);
+    const size_t image = batch_image_size();
+    float *base        = reinterpret_cast<float *>(this->batch_blob.data);
+    this->t_batch      = 0.0;
+    for (size_t k = 0; k < count;) {
+      int32_t batch = 1;
+      if (this->batch_forward) {
+        batch = static_cast<int32_t>(this->full_batch ? this->batch_preproc.size() : count);
+      }
+      const int sz[]      = {batch, 3, ih, iw};
+      this->detections[0] = this->engine->forward(cv::Mat(4, sz, CV_32F, base + k * image));
+      this->t_batch += this->engine->get_inference_time();
+      const float *output = reinterpret_cast<const float *>(this->detections[0].data);
+      for (int32_t b = 0; b < batch && k < count; ++b, ++k) {
+        decode(k, output + static_cast<size_t>(b) * this->rows * this->dimensions);
+      }
+    }
+  }
+
+  // Tiles are letterboxed in parallel into consecutive images of the batch blob
+  const std::vector<detection> &detect_tiles(const cv::Mat &input_image, pixel_format format) {
+    const tile_scheduler &tiles = *this->tiler;
+    this->tiler->schedule(input_image, format);
+    batch_tiles.clear();
+    for (size_t i = 0; i < tiles.size(); ++i) {
+      if (tiles[i].scheduled) {
+        batch_tiles.push_back(i);
+      }
+    }
+    const size_t image = batch_image_size();
+    float *base        = reinterpret_cast<float *>(this->batch_blob.data);
+    cv::parallel_for_(cv::Range(0, static_cast<int32_t>(batch_tiles.size())), [&](const cv::Range &r) {
+      for (int32_t k = r.start; k < r.end; ++k) {
+        letterbox_blob &lb = this->batch_preproc[batch_tiles[k]];
+        lb.bind(base + k * image);
+        lb.run(input_image, format, tiles[batch_tiles[k]].rect);
+      }
+    });
+    forward_batch(batch_tiles.size(), [&](size_t k, const float *output) {
+      const size_t t = batch_tiles[k];
+      tile_candidates[t].clear();
+      decode_candidates(output, this->batch_preproc[t].get_info(), tiles[t].rect.tl(), tile_candidates[t]);
+    });
+
+    // Objects in the overlap of tiles are merged by NMS
+    candidates.clear();
+    for (const auto &c : tile_candidates) {
+      candidates.insert(candidates.end(), c.begin(), c.end());
+    }
+    return suppress(candidates);
+  }
+
+  inline void draw_label(cv::Mat &input_image, const std::string &label, int32_t left, int32_t top) const {
     // Display the label at the top of the bounding box
     int32_t baseLine;
     cv::Size label_size = cv::getTextSize(label, FONT_FACE, FONT_SCALE, THICKNESS, &baseLine);
@@ -221,18 +451,4 @@ class yolo_class {
     cv::putText(input_image, label, cv::Point(left, top + label_size.height), FONT_FACE, FONT_SCALE, YELLOW,
                 THICKNESS);
   }
-
-  // Get Output Layers Name
-  inline std::vector<std::string> getOutputsNames(const cv::dnn::Net &net) {
-    static std::vector<std::string> names;
-    if (names.empty()) {
-      std::vector<int32_t> out_layers       = net.getUnconnectedOutLayers();
-      std::vector<std::string> layers_names = net.getLayerNames();
-      names.resize(out_layers.size());
-      for (size_t i = 0; i < out_layers.size(); ++i) {
-        names[i] = layers_names[out_layers[i] - 1];
-      }
-    }
-    return names;
-  }
 };
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "yolo.hpp"
+
+// Result of an asynchronous inference
+struct yolo_result {
+  uint64_t seq;                       // submission number
+  bool skipped;                       // replaced by a newer frame before it was processed (latest_only)
+  std::vector<detection> detections;  // in frame coordinates
+  cv::Mat output_image;               // annotated image, empty unless rendering is enabled
+  int32_t trigger;                    // same as yolo_class::get_aftrigger()
+  double t_infer;                     // inference time [ms]
+};
+
+enum class async_mode {
+  latest_only,  // a pending frame is replaced by a newer one; the caller never waits
+  every_frame   // every frame is processed in submission order; submit() waits when all instances are busy
+};
+
+/**************************************************************************************************
+  Asynchronous inference on a pool of yolo_class instances
+
+  Each instance owns its network and buffers and runs on its own worker thread, so that
+  pre-processing of frame N+1 overlaps with inference of frame N. Results are delivered by a
+  future or a callback (invoked on the worker thread). With several instances results may complete
+  out of order; waiting on the futures in submission order restores it.
+  The submitted cv::Mat is referenced, not copied; pass a clone if the caller reuses its buffer
+  (e.g. a camera buffer).
+**************************************************************************************************/
+class yolo_async {
+ private:
+  struct job {
+    uint64_t seq;
+    cv::Mat frame;
+    pixel_format format;
+    std::promise<yolo_result> promise;
+    std::function<void(yolo_result &)> callback;
+  };
+
+  const async_mode mode;
+  const size_t max_pending;
+  std::vector<std::unique_ptr<yolo_class>> instances;
+  std::vector<std::thread> workers;
+  std::deque<job> jobs;
+  std::mutex mtx;
+  std::condition_variable cv_jobs;
+  std::condition_variable cv_space;
+  uint64_t next_seq;
+  bool running;
+  bool render;
+
+ public:
+  yolo_async(int32_t num_instances, async_mode m, float w, float h, float th_sc, float th_nms,
+             float th_conf)
+      : mode(m),
+        max_pending((m == async_mode::latest_only) ? 1 : static_cast<size_t>(num_instances)),
+        next_seq(0),
+        running(false),
+        render(true) {
+    for (int32_t i = 0; i < num_instances; ++i) {
+      instances.emplace_back(new yolo_class(w, h, th_sc, th_nms, th_conf));
+    }
+  }
+
+  ~yolo_async() { stop(); }
+
+  void init(const char *fname_class_list, const char *onnx_file,
+            const engine_options &options = engine_options()) {
+    for (auto &yolo : instances) {
+      yolo->init(fname_class_list, onnx_file, options);
+    }
+    running = true;
+    for (auto &yolo : instances) {
+      yolo_class *p = yolo.get();
+      workers.emplace_back([this, p] { worker(*p); });
+    }
+  }
+
+  // Tiled detection on every instance (see yolo_class::set_tiling); call after init(), before submitting
+  void set_tiling(int32_t cols, int32_t rows, float overlap = 0.2f, float sad = 0.0f) {
+    for (auto &yolo : instances) {
+      yolo->set_tiling(cols, rows, overlap, sad);
+    }
+  }
+
+  std::future<yolo_result> submit(const cv::Mat &frame, pixel_format format = pixel_format::bgr) {
+    return enqueue(frame, format, nullptr);
+  }
+
+  void submit(const cv::Mat &frame, std::function<void(yolo_result &)> callback,
+              pixel_format format = pixel_format::bgr) {
+    enqueue(frame, format, std::move(callback));
+  }
+
+  size_t num_instances() const { return instances.size(); }
+
+  // Whether workers return annotated copies of the frames; call before init()
+  void set_rendering(bool enable) { render = enable; }
+
+  // Overlay detections onto an image (may be called from any thread)
+  void draw(cv::Mat &image, const std::vector<detection> &dets) const { instances[0]->draw(image, dets); }
+
+  // Pending jobs are completed before the workers exit
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!running) {
+        return;
+      }
+      running = false;
+    }
+    cv_jobs.notify_all();
+    cv_space.notify_all();
+    for (auto &th : workers) {
+      th.join();
+    }
+    workers.clear();
+  }
+
+ private:
+  std::future<yolo_result> enqueue(const cv::Mat &frame, pixel_format format,
+                                   std::function<void(yolo_result &)> callback) {
+    job j;
+    j.frame    = frame;
+    j.format   = format;
+    j.callback = std::move(callback);
+    std::future<yolo_result> f = j.promise.get_future();
+    std::deque<job> replaced;
+    bool accepted;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      j.seq = next_seq++;
+      if (mode == async_mode::latest_only) {
+        // Replace the frame that has not been picked up yet
+        replaced.swap(jobs);
+      } else {
+        cv_space.wait(lock, [this] { return jobs.size() < max_pending || !running; });
+      }
+      accepted = running;
+      if (accepted) {
+        jobs.push_back(std::move(j));
+      }
+    }
+    // Callbacks are invoked outside of the lock
+    for (auto &old : replaced) {
+      finish(old, skipped_result(old.seq));
+    }
+    if (accepted) {
+      cv_jobs.notify_one();
+    } else {
+      finish(j, skipped_result(j.seq));
+    }
+    return f;
+  }
+
+  void worker(yolo_class &yolo) {
+    while (true) {
+      job j;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_jobs.wait(lock, [this] { return !jobs.empty() || !running; });
+        if (jobs.empty()) {
+          return;
+        }
+        j = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      cv_space.notify_one();
+
+      yolo_result r;
+      r.seq        = j.seq;
+      r.skipped    = false;
+      r.detections = yolo.detect(j.frame, j.format);
+      r.trigger    = yolo.get_aftrigger();
+      r.t_infer    = yolo.get_inference_time();
+      if (render) {
+        if (j.format == pixel_format::i420) {
+          cv::cvtColor(j.frame, r.output_image, cv::COLOR_YUV2BGR_I420);
+        } else {
+          r.output_image = j.frame.clone();
+        }
+        yolo.draw(r.output_image, r.detections);
+      }
+      finish(j, std::move(r));
+    }
+  }
+
+  static yolo_result skipped_result(uint64_t seq) {
+    yolo_result r;
+    r.seq     = seq;
+    r.skipped = true;
+    r.trigger = 0;
+    r.t_infer = 0.0;
+    return r;
+  }
+
+  static void finish(job &j, yolo_result &&r) {
+    if (j.callback) {
+      j.callback(r);
+    }
+    j.promise.set_value(std::move(r));
+  }
+};
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+#include "inference_engine.hpp"
+#include "yolo_decoder.hpp"
+#include "yolo_nms.hpp"
+#include "yolo_preprocess.hpp"
+
+#include "model_config.hpp"
+
+/**************************************************************************************************
+  Calibration and accuracy-drift tool for quantized (INT8) and FP16 models
+
+  1. Writes the letterboxed NCHW input tensors of every image in <image_dir> as .npy files into
+     <output_dir>. They are exactly what yolo_class feeds to the network and can be read by a
+     CalibrationDataReader of onnxruntime.quantization.quantize_static (see README).
+  2. If <quantized_model> is given, runs it and the FP32 model on the same tensors and reports
+     the drift of the raw outputs and of the detections after NMS, and the inference times.
+**************************************************************************************************/
+
+struct box_result {
+  cv::Rect2f box;
+  int32_t class_id;
+  float score;
+};
+
+// Write a float32 tensor in NumPy .npy format (version 1.0)
+static bool write_npy(const std::string &fname, const cv::Mat &tensor) {
+  std::string shape = "(";
+  for (int32_t i = 0; i < tensor.dims; ++i) {
+    shape += std::to_string(tensor.size[i]) + ", ";
+  }
+  shape.pop_back();
+  shape.back()       = ')';
+  std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': " + shape + ", }";
+  // magic(6) + version(2) + header length(2) + header shall be a multiple of 64
+  const size_t total = ((10 + header.size() + 1 + 63) / 64) * 64;
+  header.append(total - 10 - header.size() - 1, ' ');
+  header += '\n';
+  std::ofstream ofs(fname, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+  const uint16_t hlen = static_cast<uint16_t>(header.size());
+  const char magic[]  = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+  ofs.write(magic, sizeof(magic));
+  ofs.put(static_cast<char>(hlen & 0xFF));
+  ofs.put(static_cast<char>(hlen >> 8));
+  ofs.write(header.data(), header.size());
+  ofs.write(reinterpret_cast<const char *>(tensor.data), tensor.total() * sizeof(float));
+  return ofs.good();
+}
+
+// Decode + NMS in model coordinates
+static void postprocess(const cv::Mat &out, yolo_decoder &decoder, yolo_nms &nms,
+                        std::vector<box_result> &results) {
+  const int32_t rows       = (out.dims == 3) ? out.size[1] : out.size[0];
+  const int32_t dimensions = (out.dims == 3) ? out.size[2] : out.size[1];
+  if (decoder.capacity() < static_cast<size_t>(rows)) {
+    decoder.reserve(rows);
+  }
+  const size_t n = decoder.decode(reinterpret_cast<const float *>(out.data), rows, dimensions,
+                                  CONFIDENCE_THRESHOLD, SCORE_THRESHOLD);
+  nms.clear();
+  for (size_t i = 0; i < n; ++i) {
+    nms.push(decoder.cx[i] - 0.5f * decoder.w[i], decoder.cy[i] - 0.5f * decoder.h[i], decoder.w[i],
+             decoder.h[i], decoder.confidence[i], decoder.class_id[i]);
+  }
+  results.clear();
+  for (int32_t idx : nms.run(SCORE_THRESHOLD)) {
+    const cv::Rect2f box(decoder.cx[idx] - 0.5f * decoder.w[idx], decoder.cy[idx] - 0.5f * decoder.h[idx],
+                         decoder.w[idx], decoder.h[idx]);
+    results.push_back({box, decoder.class_id[idx], decoder.confidence[idx]});
+  }
+}
+
+static float iou(const cv::Rect2f &a, const cv::Rect2f &b) {
+  const float x0 = std::max(a.x, b.x), y0 = std::max(a.y, b.y);
+  const float x1 = std::min(a.x + a.width, b.x + b.width), y1 = std::min(a.y + a.height, b.y + b.height);
+  const float inter = std::max(0.0f, x1 - x0) * std::max(0.0f, y1 - y0);
+  const float uni   = a.width * a.height + b.width * b.height - inter;
+  return (uni > 0.0f) ? inter / uni : 0.0f;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 5 && argc != 6) {
+    printf("usage: %s class_list fp32_model(.onnx) image_dir output_dir <quantized_model(.onnx)>\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *fname_class_list = argv[1];
+  const char *fp32_file        = argv[2];
+  const std::filesystem::path image_dir(argv[3]);
+  const std::filesystem::path output_dir(argv[4]);
+  const char *quant_file = (argc == 6) ? argv[5] : nullptr;
+
+  // Number of classes
+  std::ifstream ifs(fname_class_list);
+  if (!ifs) {
+    printf("ERROR: could not find %s!\n", fname_class_list);
+    return EXIT_FAILURE;
+  }
+  int32_t num_classes = 0;
+  std::string line;
+  while (getline(ifs, line)) {
+    num_classes += line.empty() ? 0 : 1;
+  }
+
+  // Collect frames
+  std::vector<std::filesystem::path> images;
+  for (const auto &entry : std::filesystem::directory_iterator(image_dir)) {
+    std::string ext = entry.path().extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" || ext == ".ppm") {
+      images.push_back(entry.path());
+    }
+  }
+  std::sort(images.begin(), images.end());
+  if (images.empty()) {
+    printf("ERROR: no images found in %s\n", image_dir.c_str());
+    return EXIT_FAILURE;
+  }
+  std::filesystem::create_directories(output_dir);
+
+  float model_width, model_height;
+  get_model_size(model_width, model_height);
+  letterbox_blob preproc;
+  preproc.create(static_cast<int32_t>(model_width), static_cast<int32_t>(model_height));
+
+  // FP32 reference and quantized model run on the same backend
+  engine_options opt_ref = get_engine_options();
+  opt_ref.precision      = "fp32";
+  std::unique_ptr<inference_engine> ref, quant;
+  try {
+    ref = create_inference_engine(opt_ref);
+    ref->load(fp32_file);
+    if (quant_file) {
+      quant = create_inference_engine(get_engine_options());
+      quant->load(quant_file);
+    }
+  } catch (std::exception &exc) {
+    return EXIT_FAILURE;
+  }
+
+  yolo_decoder dec_ref, dec_quant;
+  yolo_nms nms(NMS_THRESHOLD);
+  std::vector<box_result> det_ref, det_quant;
+  double t_ref = 0.0, t_quant = 0.0;
+  double sum_abs_obj = 0.0, max_abs_obj = 0.0, sum_abs_box = 0.0;
+  size_t num_rows = 0, num_ref = 0, num_quant = 0, num_matched = 0;
+  double sum_iou = 0.0, sum_score_diff = 0.0;
+
+  std::ofstream list(output_dir / "calibration.txt");
+  for (size_t n = 0; n < images.size(); ++n) {
+    cv::Mat img = cv::imread(images[n].string(), cv::IMREAD_COLOR);
+    if (img.empty()) {
+      printf("WARNING: could not read %s\n", images[n].c_str());
+      continue;
+    }
+    preproc.run(img);
+    const std::string npy = images[n].stem().string() + ".npy";
+    if (!write_npy((output_dir / npy).string(), preproc.get_blob())) {
+      printf("ERROR: could not write %s\n", (output_dir / npy).c_str());
+      return EXIT_FAILURE;
+    }
+    list << npy << "\n";
+    if (!quant) {
+      continue;
+    }
+
+    const cv::Mat out_ref = ref->forward(preproc.get_blob()).clone();
+    t_ref += ref->get_inference_time();
+    const cv::Mat &out_quant = quant->forward(preproc.get_blob());
+    t_quant += quant->get_inference_time();
+    if (out_ref.total() != out_quant.total()) {
+      printf("ERROR: output shapes of the models differ\n");
+      return EXIT_FAILURE;
+    }
+    const int32_t dimensions = out_ref.size[out_ref.dims - 1];
+    if (dimensions != num_classes + 5) {
+      printf("ERROR: %s outputs %d values per row, but %s has %d classes\n", fp32_file, dimensions,
+             fname_class_list, num_classes);
+      return EXIT_FAILURE;
+    }
+
+    // Drift of raw outputs on rows the FP32 model considers as objects
+    const float *a = reinterpret_cast<const float *>(out_ref.data);
+    const float *b = reinterpret_cast<const float *>(out_quant.data);
+    for (size_t i = 0; i < out_ref.total(); i += dimensions) {
+      if (a[i + 4] < CONFIDENCE_THRESHOLD) {
+        continue;
+      }
+      const double d = std::abs(a[i + 4] - b[i + 4]);
+      sum_abs_obj += d;
+      max_abs_obj = std::max(max_abs_obj, d);
+      for (int32_t k = 0; k < 4; ++k) {
+        sum_abs_box += std::abs(a[i + k] - b[i + k]);
+      }
+      num_rows++;
+    }
+
+    // Drift of detections: match each FP32 detection to the best quantized one of the same class
+    postprocess(out_ref, dec_ref, nms, det_ref);
+    postprocess(out_quant, dec_quant, nms, det_quant);
+    num_ref += det_ref.size();
+    num_quant += det_quant.size();
+    for (const auto &r : det_ref) {
+      float best = 0.0f;
+      float diff = 0.0f;
+      for (const auto &q : det_quant) {
+        if (q.class_id != r.class_id) continue;
+        const float v = iou(r.box, q.box);
+        if (v > best) {
+          best = v;
+          diff = std::abs(r.score - q.score);
+        }
+      }
+      if (best >= 0.5f) {
+        num_matched++;
+        sum_iou += best;
+        sum_score_diff += diff;
+      }
+    }
+  }
+  list.close();
+  printf("%zu calibration tensors of %d x %d written to %s\n", images.size(),
+         static_cast<int32_t>(model_width), static_cast<int32_t>(model_height), output_dir.c_str());
+
+  if (quant) {
+    const double N = static_cast<double>(images.size());
+    printf("Accuracy drift of %s against %s (%s backend)\n", quant_file, fp32_file, ref->name());
+    printf("  objectness   : mean abs error %.5f, max abs error %.5f over %zu rows\n",
+           num_rows ? sum_abs_obj / num_rows : 0.0, max_abs_obj, num_rows);
+    printf("  box (x,y,w,h): mean abs error %.3f pixels\n",
+           num_rows ? sum_abs_box / (4.0 * num_rows) : 0.0);
+    printf("  detections   : FP32 %zu, quantized %zu, matched %zu (recall %.2f%%)\n", num_ref, num_quant,
+           num_matched, num_ref ? 100.0 * num_matched / num_ref : 100.0);
+    printf("  matched      : mean IoU %.4f, mean abs score difference %.4f\n",
+           num_matched ? sum_iou / num_matched : 0.0, num_matched ? sum_score_diff / num_matched : 0.0);
+    printf("  inference    : FP32 %.2f ms, quantized %.2f ms per frame\n", t_ref / N, t_quant / N);
+  }
+  return EXIT_SUCCESS;
+}
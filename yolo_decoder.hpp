@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  #include <arm_neon.h>
+  #define YOLO_DECODER_NEON
+#elif defined(__AVX2__)
+  #include <immintrin.h>
+  #define YOLO_DECODER_AVX2
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+  #define YOLO_DECODER_SSE2
+#endif
+
+/**************************************************************************************************
+  Argmax of n floats; ties resolve to the lowest index (same as cv::minMaxLoc)
+**************************************************************************************************/
+static inline int32_t argmax_f32(const float *p, int32_t n, float &max_value) {
+  int32_t i   = 0;
+  int32_t idx = 0;
+  float m     = p[0];
+#if defined(YOLO_DECODER_NEON)
+  if (n >= 8) {
+    const uint32x4_t four = vdupq_n_u32(4);
+    uint32x4_t cur        = {0, 1, 2, 3};
+    float32x4_t vmax      = vld1q_f32(p);
+    uint32x4_t vidx       = cur;
+    for (i = 4; i + 4 <= n; i += 4) {
+      cur            = vaddq_u32(cur, four);
+      float32x4_t v  = vld1q_f32(p + i);
+      uint32x4_t gt  = vcgtq_f32(v, vmax);
+      vmax           = vbslq_f32(gt, v, vmax);
+      vidx           = vbslq_u32(gt, cur, vidx);
+    }
+    m              = vmaxvq_f32(vmax);
+    uint32x4_t eq  = vceqq_f32(vmax, vdupq_n_f32(m));
+    idx            = static_cast<int32_t>(vminvq_u32(vbslq_u32(eq, vidx, vdupq_n_u32(UINT32_MAX))));
+  }
+#elif defined(YOLO_DECODER_AVX2)
+  if (n >= 16) {
+    const __m256i eight = _mm256_set1_epi32(8);
+    __m256i cur         = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 vmax         = _mm256_loadu_ps(p);
+    __m256i vidx        = cur;
+    for (i = 8; i + 8 <= n; i += 8) {
+      cur       = _mm256_add_epi32(cur, eight);
+      __m256 v  = _mm256_loadu_ps(p + i);
+      __m256 gt = _mm256_cmp_ps(v, vmax, _CMP_GT_OQ);
+      vmax      = _mm256_blendv_ps(vmax, v, gt);
+      vidx      = _mm256_blendv_epi8(vidx, cur, _mm256_castps_si256(gt));
+    }
+    alignas(32) float lane_max[8];
+    alignas(32) int32_t lane_idx[8];
+    _mm256_store_ps(lane_max, vmax);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lane_idx), vidx);
+    m   = lane_max[0];
+    idx = lane_idx[0];
+    for (int32_t l = 1; l < 8; ++l) {
+      if (lane_max[l] > m || (lane_max[l] == m && lane_idx[l] < idx)) {
+        m   = lane_max[l];
+        idx = lane_idx[l];
+      }
+    }
+  }
+#elif defined(YOLO_DECODER_SSE2)
+  if (n >= 8) {
+    const __m128i four = _mm_set1_epi32(4);
+    __m128i cur        = _mm_setr_epi32(0, 1, 2, 3);
+    __m128 vmax        = _mm_loadu_ps(p);
+    __m128i vidx       = cur;
+    for (i = 4; i + 4 <= n; i += 4) {
+      cur        = _mm_add_epi32(cur, four);
+      __m128 v   = _mm_loadu_ps(p + i);
+      __m128 gt  = _mm_cmpgt_ps(v, vmax);
+      __m128i gi = _mm_castps_si128(gt);
+      vmax       = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, vmax));
+      vidx       = _mm_or_si128(_mm_and_si128(gi, cur), _mm_andnot_si128(gi, vidx));
+    }
+    alignas(16) float lane_max[4];
+    alignas(16) int32_t lane_idx[4];
+    _mm_store_ps(lane_max, vmax);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lane_idx), vidx);
+    m   = lane_max[0];
+    idx = lane_idx[0];
+    for (int32_t l = 1; l < 4; ++l) {
+      if (lane_max[l] > m || (lane_max[l] == m && lane_idx[l] < idx)) {
+        m   = lane_max[l];
+        idx = lane_idx[l];
+      }
+    }
+  }
+#endif
+  // Remaining elements (or all of them when no SIMD path is taken)
+  for (i = (i == 0) ? 1 : i; i < n; ++i) {
+    if (p[i] > m) {
+      m   = p[i];
+      idx = i;
+    }
+  }
+  max_value = m;
+  return idx;
+}
+
+/**************************************************************************************************
+  Decoder of the raw YOLOv5 output tensor
+
+  Single row of the tensor consists of;
+  | 0 | 1 | 2 | 3 |      4     | 5 ...                            |
+  | X | Y | W | H | Confidence | Class scores of num_classes classes |
+  Surviving candidates are stored in model coordinates as structure of arrays. Buffers are sized
+  once by reserve(), so decode() never allocates.
+**************************************************************************************************/
+class yolo_decoder {
+ public:
+  std::vector<float> cx, cy, w, h;  // box center and dimension
+  std::vector<float> confidence;    // objectness
+  std::vector<float> class_score;   // best class score
+  std::vector<int32_t> class_id;    // best class index
+  size_t count;
+
+  yolo_decoder() : count(0) {}
+
+  void reserve(size_t rows) {
+    cx.resize(rows);
+    cy.resize(rows);
+    w.resize(rows);
+    h.resize(rows);
+    confidence.resize(rows);
+    class_score.resize(rows);
+    class_id.resize(rows);
+    count = 0;
+  }
+
+  size_t capacity() const { return cx.size(); }
+
+  size_t decode(const float *data, int32_t rows, int32_t dimensions, float confidence_threshold,
+                float score_threshold) {
+    const int32_t num_classes = dimensions - 5;
+    const size_t limit        = (static_cast<size_t>(rows) < capacity()) ? rows : capacity();
+    size_t n                  = 0;
+    const float *p            = data;
+    for (size_t i = 0; i < limit; ++i, p += dimensions) {
+      // Discard bad detections first, most of the rows stop here
+      if (p[4] < confidence_threshold) {
+        continue;
+      }
+      float max_class_score;
+      int32_t id = argmax_f32(p + 5, num_classes, max_class_score);
+      if (max_class_score > score_threshold) {
+        cx[n]          = p[0];
+        cy[n]          = p[1];
+        w[n]           = p[2];
+        h[n]           = p[3];
+        confidence[n]  = p[4];
+        class_score[n] = max_class_score;
+        class_id[n]    = id;
+        ++n;
+      }
+    }
+    count = n;
+    return n;
+  }
+};
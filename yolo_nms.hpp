@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  #include <arm_neon.h>
+  #define YOLO_NMS_NEON
+#elif defined(__AVX2__)
+  #include <immintrin.h>
+  #define YOLO_NMS_AVX2
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+  #define YOLO_NMS_SSE2
+#endif
+
+/**************************************************************************************************
+  Class-aware non-maximum suppression
+
+  Candidates are pushed as float boxes (structure of arrays). run() orders them without sorting:
+  scores at or above the minimum are counted into a histogram of SCORE_BINS bins, and the prefix
+  sums place each candidate at its rank, which also selects the top_k best in O(n). Candidates of
+  equal bin (scores within 1/SCORE_BINS of the score range) keep their input order. A stable
+  counting pass then groups them by class, so that each class is a contiguous run in decreasing
+  score, and greedy suppression within a class computes the IoU of the kept box with all the boxes
+  after it 4 or 8 at a time (NEON/SSE2/AVX2); a box is suppressed when IoU > iou_threshold, as in
+  cv::dnn::NMSBoxes. Objects of different classes never suppress each other. At most max_det boxes
+  are kept, the best ones. Buffers are sized by reserve() and only grow, so run() does not allocate
+  in steady state.
+**************************************************************************************************/
+class yolo_nms {
+ private:
+  static constexpr int32_t SCORE_BINS = 1024;
+
+  float iou_threshold;
+  size_t top_k;
+  size_t max_det;
+  // Input
+  std::vector<float> x0, y0, x1, y1, score;
+  std::vector<int32_t> class_id;
+  size_t count;
+  // Scratch
+  std::vector<uint32_t> bins;
+  std::vector<int32_t> order;      // candidate of each rank
+  std::vector<uint32_t> classes;   // start of each class in the grouped arrays
+  std::vector<float> gx0, gy0, gx1, gy1, garea;  // grouped by class, by decreasing score
+  std::vector<int32_t> gidx;                     // candidate of each grouped entry
+  std::vector<uint32_t> dead;                    // all ones once suppressed
+  std::vector<int32_t> kept;
+
+ public:
+  yolo_nms(float iou = 0.45f, size_t k = 2048, size_t det = 300)
+      : iou_threshold(iou), top_k(k), max_det(det), count(0), bins(SCORE_BINS + 1) {}
+
+  void reserve(size_t n) {
+    for (auto *v : {&x0, &y0, &x1, &y1, &score, &gx0, &gy0, &gx1, &gy1, &garea}) {
+      v->resize(std::max(v->size(), n));
+    }
+    for (auto *v : {&class_id, &order, &gidx, &kept}) {
+      v->resize(std::max(v->size(), n));
+    }
+    dead.resize(std::max(dead.size(), n));
+    kept.clear();
+  }
+
+  void clear() { count = 0; }
+
+  size_t size() const { return count; }
+
+  // Candidate box with its top-left corner and size
+  void push(float x, float y, float w, float h, float s, int32_t c) {
+    if (count == score.size()) {
+      reserve(std::max<size_t>(2 * count, 64));
+    }
+    x0[count]       = x;
+    y0[count]       = y;
+    x1[count]       = x + w;
+    y1[count]       = y + h;
+    score[count]    = s;
+    class_id[count] = std::max(c, 0);
+    count++;
+  }
+
+  // Indices of the kept candidates (in push order), by class and then by decreasing score;
+  // candidates scored below min_score are dropped. Valid until the next call.
+  const std::vector<int32_t> &run(float min_score) {
+    kept.clear();
+    const size_t n = rank(min_score);
+    group(n);
+
+    // Greedy suppression within each class
+    for (size_t c = 0; c + 1 < classes.size(); ++c) {
+      const size_t end = classes[c + 1];
+      for (size_t i = classes[c]; i < end; ++i) {
+        if (dead[i]) {
+          continue;
+        }
+        kept.push_back(gidx[i]);
+        suppress(i, i + 1, end);
+      }
+    }
+    if (kept.size() > max_det) {
+      std::nth_element(kept.begin(), kept.begin() + max_det, kept.end(),
+                       [this](int32_t a, int32_t b) { return score[a] > score[b]; });
+      kept.resize(max_det);
+    }
+    return kept;
+  }
+
+ private:
+  // Fills order[] with the best top_k candidates by decreasing score bin; returns their number
+  size_t rank(float min_score) {
+    const float scale = SCORE_BINS / std::max(1.0f - min_score, 1e-6f);
+    std::fill(bins.begin(), bins.end(), 0);
+    for (size_t i = 0; i < count; ++i) {
+      if (score[i] >= min_score) {
+        bins[bin_of(score[i], min_score, scale) + 1]++;
+      }
+    }
+    for (int32_t b = 0; b < SCORE_BINS; ++b) {
+      bins[b + 1] += bins[b];
+    }
+    const size_t total = bins[SCORE_BINS];
+    const size_t n     = std::min(total, top_k);
+    for (size_t i = 0; i < count; ++i) {
+      if (score[i] >= min_score) {
+        const uint32_t pos = bins[bin_of(score[i], min_score, scale)]++;
+        if (pos < n) {
+          order[pos] = static_cast<int32_t>(i);
+        }
+      }
+    }
+    return n;
+  }
+
+  // Highest scores first
+  static int32_t bin_of(float s, float min_score, float scale) {
+    const int32_t b = static_cast<int32_t>((s - min_score) * scale);
+    return SCORE_BINS - 1 - std::min(std::max(b, 0), SCORE_BINS - 1);
+  }
+
+  // Stable counting sort of the ranked candidates by class into the grouped arrays
+  void group(size_t n) {
+    int32_t num_classes = 0;
+    for (size_t r = 0; r < n; ++r) {
+      num_classes = std::max(num_classes, class_id[order[r]] + 1);
+    }
+    classes.assign(num_classes + 1, 0);
+    for (size_t r = 0; r < n; ++r) {
+      classes[class_id[order[r]] + 1]++;
+    }
+    for (int32_t c = 0; c < num_classes; ++c) {
+      classes[c + 1] += classes[c];
+    }
+    for (size_t r = 0; r < n; ++r) {
+      const int32_t i = order[r];
+      const size_t g  = classes[class_id[i]]++;
+      gx0[g]          = x0[i];
+      gy0[g]          = y0[i];
+      gx1[g]          = x1[i];
+      gy1[g]          = y1[i];
+      garea[g]        = (x1[i] - x0[i]) * (y1[i] - y0[i]);
+      gidx[g]         = i;
+      dead[g]         = 0;
+    }
+    // The counting pass moved every start to the end of its class
+    for (int32_t c = num_classes; c > 0; --c) {
+      classes[c] = classes[c - 1];
+    }
+    if (!classes.empty()) {
+      classes[0] = 0;
+    }
+  }
+
+  // Marks the boxes in [begin, end) overlapping box i by more than the threshold
+  void suppress(size_t i, size_t begin, size_t end) {
+    const float ax0 = gx0[i], ay0 = gy0[i], ax1 = gx1[i], ay1 = gy1[i], aarea = garea[i];
+    const float thr = iou_threshold;
+    size_t j        = begin;
+#if defined(YOLO_NMS_NEON)
+    const float32x4_t vx0 = vdupq_n_f32(ax0), vy0 = vdupq_n_f32(ay0);
+    const float32x4_t vx1 = vdupq_n_f32(ax1), vy1 = vdupq_n_f32(ay1);
+    const float32x4_t va = vdupq_n_f32(aarea), vt = vdupq_n_f32(thr), zero = vdupq_n_f32(0.0f);
+    for (; j + 4 <= end; j += 4) {
+      const float32x4_t l     = vmaxq_f32(vx0, vld1q_f32(&gx0[j]));
+      const float32x4_t t     = vmaxq_f32(vy0, vld1q_f32(&gy0[j]));
+      const float32x4_t r     = vminq_f32(vx1, vld1q_f32(&gx1[j]));
+      const float32x4_t b     = vminq_f32(vy1, vld1q_f32(&gy1[j]));
+      const float32x4_t w     = vmaxq_f32(vsubq_f32(r, l), zero);
+      const float32x4_t h     = vmaxq_f32(vsubq_f32(b, t), zero);
+      const float32x4_t inter = vmulq_f32(w, h);
+      const float32x4_t uni   = vsubq_f32(vaddq_f32(va, vld1q_f32(&garea[j])), inter);
+      const uint32x4_t over   = vcgtq_f32(inter, vmulq_f32(vt, uni));
+      vst1q_u32(&dead[j], vorrq_u32(vld1q_u32(&dead[j]), over));
+    }
+#elif defined(YOLO_NMS_AVX2)
+    const __m256 vx0 = _mm256_set1_ps(ax0), vy0 = _mm256_set1_ps(ay0);
+    const __m256 vx1 = _mm256_set1_ps(ax1), vy1 = _mm256_set1_ps(ay1);
+    const __m256 va = _mm256_set1_ps(aarea), vt = _mm256_set1_ps(thr), zero = _mm256_setzero_ps();
+    for (; j + 8 <= end; j += 8) {
+      const __m256 l     = _mm256_max_ps(vx0, _mm256_loadu_ps(&gx0[j]));
+      const __m256 t     = _mm256_max_ps(vy0, _mm256_loadu_ps(&gy0[j]));
+      const __m256 r     = _mm256_min_ps(vx1, _mm256_loadu_ps(&gx1[j]));
+      const __m256 b     = _mm256_min_ps(vy1, _mm256_loadu_ps(&gy1[j]));
+      const __m256 w     = _mm256_max_ps(_mm256_sub_ps(r, l), zero);
+      const __m256 h     = _mm256_max_ps(_mm256_sub_ps(b, t), zero);
+      const __m256 inter = _mm256_mul_ps(w, h);
+      const __m256 uni   = _mm256_sub_ps(_mm256_add_ps(va, _mm256_loadu_ps(&garea[j])), inter);
+      const __m256 over  = _mm256_cmp_ps(inter, _mm256_mul_ps(vt, uni), _CMP_GT_OQ);
+      float *d           = reinterpret_cast<float *>(&dead[j]);
+      _mm256_storeu_ps(d, _mm256_or_ps(_mm256_loadu_ps(d), over));
+    }
+#elif defined(YOLO_NMS_SSE2)
+    const __m128 vx0 = _mm_set1_ps(ax0), vy0 = _mm_set1_ps(ay0);
+    const __m128 vx1 = _mm_set1_ps(ax1), vy1 = _mm_set1_ps(ay1);
+    const __m128 va = _mm_set1_ps(aarea), vt = _mm_set1_ps(thr), zero = _mm_setzero_ps();
+    for (; j + 4 <= end; j += 4) {
+      const __m128 l     = _mm_max_ps(vx0, _mm_loadu_ps(&gx0[j]));
+      const __m128 t     = _mm_max_ps(vy0, _mm_loadu_ps(&gy0[j]));
+      const __m128 r     = _mm_min_ps(vx1, _mm_loadu_ps(&gx1[j]));
+      const __m128 b     = _mm_min_ps(vy1, _mm_loadu_ps(&gy1[j]));
+      const __m128 w     = _mm_max_ps(_mm_sub_ps(r, l), zero);
+      const __m128 h     = _mm_max_ps(_mm_sub_ps(b, t), zero);
+      const __m128 inter = _mm_mul_ps(w, h);
+      const __m128 uni   = _mm_sub_ps(_mm_add_ps(va, _mm_loadu_ps(&garea[j])), inter);
+      const __m128 over  = _mm_cmpgt_ps(inter, _mm_mul_ps(vt, uni));
+      float *d           = reinterpret_cast<float *>(&dead[j]);
+      _mm_storeu_ps(d, _mm_or_ps(_mm_loadu_ps(d), over));
+    }
+#endif
+    // Remaining boxes (or all of them when no SIMD path is taken)
+    for (; j < end; ++j) {
+      const float w     = std::max(std::min(ax1, gx1[j]) - std::max(ax0, gx0[j]), 0.0f);
+      const float h     = std::max(std::min(ay1, gy1[j]) - std::max(ay0, gy0[j]), 0.0f);
+      const float inter = w * h;
+      if (inter > thr * (aarea + garea[j] - inter)) {
+        dead[j] = ~0u;
+      }
+    }
+  }
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/utility.hpp>
+
+// Layout of source images
+enum class pixel_format {
+  bgr,  // 8-bit packed B, G, R
+  i420  // 8-bit planar Y, U, V with 2x2 subsampled chroma in one CV_8UC1 Mat of height * 3 / 2 rows;
+        // width and height are even, so that the chroma planes are exactly width / 2 x height / 2
+};
+
+// Mapping between frame and model coordinates: model = (frame - origin of the region) * scale + pad
+struct letterbox_info {
+  float scale;
+  float pad_x;
+  float pad_y;
+};
+
+/**************************************************************************************************
+  Fused letterbox pre-processing
+
+  Writes a BGR 8-bit image straight into a persistent 1x3xHxW float blob in one pass:
+  bilinear resize keeping the aspect ratio, padding with gray (114, as YOLOv5 does),
+  BGR->RGB swap, scaling by 1/255 and HWC->NCHW planarization.
+  I420 images are converted in the same pass: luma is interpolated bilinearly, chroma is taken
+  from the 2x2 block of the nearest luma sample (as cv::cvtColor does), and the full range
+  BT.601 matrix (sYCC, requested by LibCamera for YUV420 streams) gives RGB.
+  A region of the source image may be given instead of the whole of it (tiled detection), and the
+  blob may be a view of one image of a batch blob owned by the caller (bind()).
+  The blob is allocated once in create(); interpolation tables are rebuilt only when the source
+  region changes.
+**************************************************************************************************/
+class letterbox_blob {
+ private:
+  static constexpr float PAD_VALUE = 114.0f / 255.0f;
+
+  int32_t width;
+  int32_t height;
+  bool use_threads;
+  cv::Mat blob;
+  letterbox_info info;
+  // Interpolation tables
+  int32_t src_x;  // source region
+  int32_t src_y;
+  int32_t src_width;
+  int32_t src_height;
+  int32_t dst_x0, dst_x1, dst_y0, dst_y1;  // non-padded area of the model input
+  std::vector<int32_t> xofs0, xofs1;       // left/right source pixels (in the whole image)
+  std::vector<float> xw;                   // weight of the right source pixel
+  std::vector<int32_t> xc, yc;             // chroma sample of the nearest source pixel (I420)
+  std::vector<int32_t> yrow0, yrow1;       // upper/lower source rows
+  std::vector<float> yw;                   // weight of the lower source row
+
+ public:
+  letterbox_blob()
+      : width(0),
+        height(0),
+        use_threads(false),
+        info({1.0f, 0.0f, 0.0f}),
+        src_x(0),
+        src_y(0),
+        src_width(0),
+        src_height(0) {}
+
+  void create(int32_t w, int32_t h, bool parallel = false) {
+    width          = w;
+    height         = h;
+    use_threads    = parallel;
+    const int sz[] = {1, 3, h, w};
+    blob.create(4, sz, CV_32F);
+    src_width  = 0;
+    src_height = 0;
+  }
+
+  // Write into 3 x height x width floats of the caller (e.g. one image of an N x 3 x H x W blob)
+  void bind(float *data) {
+    const int sz[] = {1, 3, height, width};
+    blob           = cv::Mat(4, sz, CV_32F, data);
+  }
+
+  cv::Mat &get_blob() { return blob; }
+
+  const letterbox_info &get_info() const { return info; }
+
+  // Letterbox the region `roi` of the image, the whole image if empty
+  const letterbox_info &run(const cv::Mat &img, pixel_format format = pixel_format::bgr,
+                            const cv::Rect &roi = cv::Rect()) {
+    const int32_t rows = (format == pixel_format::i420) ? img.rows * 2 / 3 : img.rows;
+    const cv::Rect region = roi.empty() ? cv::Rect(0, 0, img.cols, rows) : roi;
+    if (region.x != src_x || region.y != src_y || region.width != src_width
+        || region.height != src_height) {
+      build_tables(region);
+    }
+    auto body = [&](const cv::Range &r) {
+      if (format == pixel_format::i420) {
+        process_rows_i420(img, rows, r.start, r.end);
+      } else {
+        process_rows(img, r.start, r.end);
+      }
+    };
+    if (use_threads) {
+      cv::parallel_for_(cv::Range(0, height), body);
+    } else {
+      body(cv::Range(0, height));
+    }
+    return info;
+  }
+
+ private:
+  void build_tables(const cv::Rect &roi) {
+    src_x      = roi.x;
+    src_y      = roi.y;
+    src_width  = roi.width;
+    src_height = roi.height;
+    const int32_t sw    = roi.width;
+    const int32_t sh    = roi.height;
+    const float scale   = std::min(static_cast<float>(width) / sw, static_cast<float>(height) / sh);
+    const int32_t new_w = std::min(width, static_cast<int32_t>(sw * scale + 0.5f));
+    const int32_t new_h = std::min(height, static_cast<int32_t>(sh * scale + 0.5f));
+    dst_x0 = (width - new_w) / 2;
+    dst_y0 = (height - new_h) / 2;
+    dst_x1 = dst_x0 + new_w;
+    dst_y1 = dst_y0 + new_h;
+    info   = {scale, static_cast<float>(dst_x0), static_cast<float>(dst_y0)};
+
+    // Pixel centers are aligned as in cv::resize(INTER_LINEAR)
+    const float inv_x = static_cast<float>(sw) / new_w;
+    const float inv_y = static_cast<float>(sh) / new_h;
+    xofs0.resize(new_w);
+    xofs1.resize(new_w);
+    xw.resize(new_w);
+    xc.resize(new_w);
+    for (int32_t x = 0; x < new_w; ++x) {
+      float fx   = (x + 0.5f) * inv_x - 0.5f;
+      fx         = std::max(fx, 0.0f);
+      int32_t sx = std::min(static_cast<int32_t>(fx), sw - 1);
+      xofs0[x]   = roi.x + sx;
+      xofs1[x]   = roi.x + std::min(sx + 1, sw - 1);
+      xw[x]      = fx - sx;
+      xc[x]      = (roi.x + std::min(static_cast<int32_t>(fx + 0.5f), sw - 1)) / 2;
+    }
+    yrow0.resize(new_h);
+    yrow1.resize(new_h);
+    yw.resize(new_h);
+    yc.resize(new_h);
+    for (int32_t y = 0; y < new_h; ++y) {
+      float fy   = (y + 0.5f) * inv_y - 0.5f;
+      fy         = std::max(fy, 0.0f);
+      int32_t sy = std::min(static_cast<int32_t>(fy), sh - 1);
+      yrow0[y]   = roi.y + sy;
+      yrow1[y]   = roi.y + std::min(sy + 1, sh - 1);
+      yw[y]      = fy - sy;
+      yc[y]      = (roi.y + std::min(static_cast<int32_t>(fy + 0.5f), sh - 1)) / 2;
+    }
+  }
+
+  void process_rows(const cv::Mat &bgr, int32_t y_begin, int32_t y_end) {
+    constexpr float norm = 1.0f / 255.0f;
+    const size_t plane   = static_cast<size_t>(width) * height;
+    float *dst_r         = reinterpret_cast<float *>(blob.data);
+    float *dst_g         = dst_r + plane;
+    float *dst_b         = dst_g + plane;
+    for (int32_t y = y_begin; y < y_end; ++y) {
+      float *r = dst_r + static_cast<size_t>(y) * width;
+      float *g = dst_g + static_cast<size_t>(y) * width;
+      float *b = dst_b + static_cast<size_t>(y) * width;
+      if (y < dst_y0 || y >= dst_y1) {
+        std::fill(r, r + width, PAD_VALUE);
+        std::fill(g, g + width, PAD_VALUE);
+        std::fill(b, b + width, PAD_VALUE);
+        continue;
+      }
+      std::fill(r, r + dst_x0, PAD_VALUE);
+      std::fill(g, g + dst_x0, PAD_VALUE);
+      std::fill(b, b + dst_x0, PAD_VALUE);
+      std::fill(r + dst_x1, r + width, PAD_VALUE);
+      std::fill(g + dst_x1, g + width, PAD_VALUE);
+      std::fill(b + dst_x1, b + width, PAD_VALUE);
+
+      const int32_t ty  = y - dst_y0;
+      const uint8_t *s0 = bgr.ptr<uint8_t>(yrow0[ty]);
+      const uint8_t *s1 = bgr.ptr<uint8_t>(yrow1[ty]);
+      const float wy1   = yw[ty] * norm;
+      const float wy0   = norm - wy1;
+      for (int32_t x = dst_x0; x < dst_x1; ++x) {
+        const int32_t tx  = x - dst_x0;
+        const uint8_t *a0 = s0 + 3 * xofs0[tx];
+        const uint8_t *a1 = s0 + 3 * xofs1[tx];
+        const uint8_t *c0 = s1 + 3 * xofs0[tx];
+        const uint8_t *c1 = s1 + 3 * xofs1[tx];
+        const float wx1   = xw[tx];
+        const float wx0   = 1.0f - wx1;
+        // BGR -> RGB planes
+        b[x] = wy0 * (wx0 * a0[0] + wx1 * a1[0]) + wy1 * (wx0 * c0[0] + wx1 * c1[0]);
+        g[x] = wy0 * (wx0 * a0[1] + wx1 * a1[1]) + wy1 * (wx0 * c0[1] + wx1 * c1[1]);
+        r[x] = wy0 * (wx0 * a0[2] + wx1 * a1[2]) + wy1 * (wx0 * c0[2] + wx1 * c1[2]);
+      }
+    }
+  }
+
+  void process_rows_i420(const cv::Mat &i420, int32_t luma_rows, int32_t y_begin, int32_t y_end) {
+    constexpr float norm = 1.0f / 255.0f;
+    const size_t plane   = static_cast<size_t>(width) * height;
+    float *dst_r         = reinterpret_cast<float *>(blob.data);
+    float *dst_g         = dst_r + plane;
+    float *dst_b         = dst_g + plane;
+    // Chroma planes follow the luma plane, with half the stride
+    const size_t luma_stride   = i420.step[0];
+    const size_t chroma_stride = luma_stride / 2;
+    const uint8_t *u_plane     = i420.data + luma_stride * luma_rows;
+    const uint8_t *v_plane     = u_plane + chroma_stride * (luma_rows / 2);
+    for (int32_t y = y_begin; y < y_end; ++y) {
+      float *r = dst_r + static_cast<size_t>(y) * width;
+      float *g = dst_g + static_cast<size_t>(y) * width;
+      float *b = dst_b + static_cast<size_t>(y) * width;
+      if (y < dst_y0 || y >= dst_y1) {
+        std::fill(r, r + width, PAD_VALUE);
+        std::fill(g, g + width, PAD_VALUE);
+        std::fill(b, b + width, PAD_VALUE);
+        continue;
+      }
+      std::fill(r, r + dst_x0, PAD_VALUE);
+      std::fill(g, g + dst_x0, PAD_VALUE);
+      std::fill(b, b + dst_x0, PAD_VALUE);
+      std::fill(r + dst_x1, r + width, PAD_VALUE);
+      std::fill(g + dst_x1, g + width, PAD_VALUE);
+      std::fill(b + dst_x1, b + width, PAD_VALUE);
+
+      const int32_t ty  = y - dst_y0;
+      const uint8_t *s0 = i420.data + luma_stride * yrow0[ty];
+      const uint8_t *s1 = i420.data + luma_stride * yrow1[ty];
+      const uint8_t *su = u_plane + chroma_stride * yc[ty];
+      const uint8_t *sv = v_plane + chroma_stride * yc[ty];
+      const float wy1   = yw[ty] * norm;
+      const float wy0   = norm - wy1;
+      for (int32_t x = dst_x0; x < dst_x1; ++x) {
+        const int32_t tx = x - dst_x0;
+        const float wx1  = xw[tx];
+        const float wx0  = 1.0f - wx1;
+        const float luma = wy0 * (wx0 * s0[xofs0[tx]] + wx1 * s0[xofs1[tx]])
+                           + wy1 * (wx0 * s1[xofs0[tx]] + wx1 * s1[xofs1[tx]]);
+        const float cb = (su[xc[tx]] - 128.0f) * norm;
+        const float cr = (sv[xc[tx]] - 128.0f) * norm;
+        r[x]           = std::min(std::max(luma + 1.402f * cr, 0.0f), 1.0f);
+        g[x]           = std::min(std::max(luma - 0.344136f * cb - 0.714136f * cr, 0.0f), 1.0f);
+        b[x]           = std::min(std::max(luma + 1.772f * cb, 0.0f), 1.0f);
+      }
+    }
+  }
+};
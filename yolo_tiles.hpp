@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "yolo_preprocess.hpp"
+
+// Region of a frame detected as one image of the batch
+struct detection_tile {
+  cv::Rect rect;   // in frame coordinates
+  cv::Mat thumb;   // luma thumbnail of the tile when it was last detected
+  int32_t age;     // frames since the tile was last detected
+  bool scheduled;  // detect in the current frame
+};
+
+/**************************************************************************************************
+  Tiling of large frames for detection
+
+  A frame is split into cols x rows tiles overlapping by `overlap` of the tile size; each tile is
+  letterboxed to the model size, so that small objects of a high-resolution frame keep enough
+  pixels. Objects smaller than the overlap are seen whole by at least one tile.
+  With a SAD threshold > 0, a tile is detected again only when its 16x16 luma thumbnail differs
+  from the one it had at its last detection by more than that (mean absolute difference in luma
+  levels), or after `refresh_interval` frames; the detections of the other tiles are reused. The
+  layout is rebuilt when the frame size changes.
+**************************************************************************************************/
+class tile_scheduler {
+ private:
+  static constexpr int32_t THUMB_SIZE = 16;
+
+  int32_t cols;
+  int32_t rows;
+  float overlap;
+  float sad_threshold;
+  int32_t refresh_interval;
+  cv::Size frame_size;
+  std::vector<detection_tile> tiles;
+  cv::Mat small;
+  cv::Mat luma;
+
+ public:
+  tile_scheduler(int32_t c, int32_t r, float ov = 0.2f, float sad = 0.0f, int32_t refresh = 30)
+      : cols(std::max(c, 1)),
+        rows(std::max(r, 1)),
+        overlap(std::min(std::max(ov, 0.0f), 0.5f)),
+        sad_threshold(sad),
+        refresh_interval(std::max(refresh, 1)),
+        tiles(static_cast<size_t>(cols) * rows) {}
+
+  size_t size() const { return tiles.size(); }
+
+  const detection_tile &operator[](size_t i) const { return tiles[i]; }
+
+  // Lays the tiles out for the frame and marks those to detect; returns their number
+  size_t schedule(const cv::Mat &frame, pixel_format format) {
+    const int32_t h = (format == pixel_format::i420) ? frame.rows * 2 / 3 : frame.rows;
+    if (frame_size != cv::Size(frame.cols, h)) {
+      layout(cv::Size(frame.cols, h));
+    }
+    size_t n = 0;
+    for (auto &t : tiles) {
+      t.scheduled = true;
+      if (sad_threshold > 0.0f) {
+        if (format == pixel_format::i420) {
+          cv::resize(frame(t.rect), luma, cv::Size(THUMB_SIZE, THUMB_SIZE), 0, 0, cv::INTER_AREA);
+        } else {
+          cv::resize(frame(t.rect), small, cv::Size(THUMB_SIZE, THUMB_SIZE), 0, 0, cv::INTER_AREA);
+          cv::cvtColor(small, luma, cv::COLOR_BGR2GRAY);
+        }
+        if (!t.thumb.empty() && ++t.age < refresh_interval
+            && cv::norm(luma, t.thumb, cv::NORM_L1) <= sad_threshold * THUMB_SIZE * THUMB_SIZE) {
+          t.scheduled = false;
+        } else {
+          luma.copyTo(t.thumb);
+          t.age = 0;
+        }
+      }
+      n += t.scheduled ? 1 : 0;
+    }
+    return n;
+  }
+
+ private:
+  void layout(const cv::Size &size) {
+    frame_size = size;
+    // cols * tw - (cols - 1) * overlap * tw = frame width
+    const float tw  = size.width / (cols - (cols - 1) * overlap);
+    const float th  = size.height / (rows - (rows - 1) * overlap);
+    const int32_t w = std::min(static_cast<int32_t>(tw + 0.5f), size.width);
+    const int32_t h = std::min(static_cast<int32_t>(th + 0.5f), size.height);
+    for (int32_t j = 0; j < rows; ++j) {
+      for (int32_t i = 0; i < cols; ++i) {
+        // The last tile of a row/column ends at the edge of the frame
+        const int32_t x   = (cols > 1) ? (size.width - w) * i / (cols - 1) : 0;
+        const int32_t y   = (rows > 1) ? (size.height - h) * j / (rows - 1) : 0;
+        detection_tile &t = tiles[static_cast<size_t>(j) * cols + i];
+        t.rect            = cv::Rect(x, y, w, h);
+        t.thumb.release();
+        t.age       = 0;
+        t.scheduled = true;
+      }
+    }
+  }
+};